@@ -3,7 +3,8 @@ include(coverage.pri)
 TEMPLATE = subdirs
 
 SUBDIRS += \
-    src
+    src \
+    tools
 
 !CONFIG(no_tests) {
     SUBDIRS += tests
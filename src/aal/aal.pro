@@ -21,9 +21,16 @@ HEADERS += \
     aalmediaplayerservice.h \
     aalmediaplayerserviceplugin.h \
     aalvideorenderercontrol.h \
+    aalvideoframepool.h \
+    aalsharedsignalrouter.h \
     aalmediaplaylistprovider.h \
     aalmediaplaylistcontrol.h \
     aalaudiorolecontrol.h \
+    aalbackendwatchdog.h \
+    aalflightrecorder.h \
+    aallogging.h \
+    aalplayercommandqueue.h \
+    aaltracer.h \
     aalutility.h
 
 SOURCES += \
@@ -31,7 +38,14 @@ SOURCES += \
     aalmediaplayerservice.cpp \
     aalmediaplayerserviceplugin.cpp \
     aalvideorenderercontrol.cpp \
+    aalvideoframepool.cpp \
+    aalsharedsignalrouter.cpp \
     aalmediaplaylistprovider.cpp \
     aalmediaplaylistcontrol.cpp \
     aalaudiorolecontrol.cpp \
+    aalbackendwatchdog.cpp \
+    aalflightrecorder.cpp \
+    aallogging.cpp \
+    aalplayercommandqueue.cpp \
+    aaltracer.cpp \
     aalutility.cpp
@@ -15,6 +15,8 @@
  */
 
 #include "aalaudiorolecontrol.h"
+#include "aalbackendwatchdog.h"
+#include "aallogging.h"
 
 #include <QDebug>
 
@@ -25,9 +27,15 @@ AalAudioRoleControl::AalAudioRoleControl
     : QAudioRoleControl()
     , m_audioRole(QAudio::MusicRole)
     , m_hubPlayerSession(playerSession)
+    , m_backendLock(nullptr)
 {
 }
 
+void AalAudioRoleControl::setPlayerSession(const std::shared_ptr<lomiri::MediaHub::Player>& playerSession)
+{
+    m_hubPlayerSession = playerSession;
+}
+
 QAudio::Role AalAudioRoleControl::audioRole() const
 {
     return m_audioRole;
@@ -37,11 +45,14 @@ void AalAudioRoleControl::setAudioRole(QAudio::Role role)
 {
     if (m_hubPlayerSession == nullptr)
     {
-        qWarning() << "Failed to setAudioRole since m_hubPlayerSession is NULL";
+        qCWarning(aalPlayer) << "Failed to setAudioRole since m_hubPlayerSession is NULL";
         return;
     }
 
-    m_hubPlayerSession->setAudioStreamRole(fromQAudioRole(role));
+    {
+        AAL_BACKEND_CALL("Player::setAudioStreamRole");
+        m_hubPlayerSession->setAudioStreamRole(fromQAudioRole(role));
+    }
 
     if (role != m_audioRole)
         Q_EMIT audioRoleChanged(m_audioRole = role);
@@ -70,7 +81,7 @@ QAudio::Role AalAudioRoleControl::toQAudioRole(const media::Player::AudioStreamR
         case media::Player::AudioStreamRole::PhoneRole:
             return QAudio::VoiceCommunicationRole;
         default:
-            qWarning() << "Unhandled or invalid lomiri::MediaHub::AudioStreamRole: " << role;
+            qCWarning(aalPlayer) << "Unhandled or invalid lomiri::MediaHub::AudioStreamRole: " << role;
             return QAudio::MusicRole;
     }
 }
@@ -94,7 +105,7 @@ media::Player::AudioStreamRole AalAudioRoleControl::fromQAudioRole(const QAudio:
         case QAudio::VoiceCommunicationRole:
             return media::Player::AudioStreamRole::PhoneRole;
         default:
-            qWarning() << "Unhandled or invalid QAudio::Role:" << role;
+            qCWarning(aalPlayer) << "Unhandled or invalid QAudio::Role:" << role;
             return media::Player::AudioStreamRole::MultimediaRole;
     }
 }
@@ -23,6 +23,8 @@
 
 #include <memory>
 
+class AalBackendLock;
+
 class AalAudioRoleControl : public QAudioRoleControl
 {
 public:
@@ -37,14 +39,21 @@ public:
     void setAudioRole(QAudio::Role role);
     QList<QAudio::Role> supportedAudioRoles() const;
 
+    void setPlayerSession(const std::shared_ptr<lomiri::MediaHub::Player>& playerSession);
+    // The owning service's lock, taken around every media-hub call
+    void setBackendLock(AalBackendLock *lock) { m_backendLock = lock; }
+
     static QAudio::Role toQAudioRole
         (const lomiri::MediaHub::Player::AudioStreamRole &role);
     static lomiri::MediaHub::Player::AudioStreamRole fromQAudioRole
         (const QAudio::Role &role);
 
 private:
+    AalBackendLock *backendLock() const { return m_backendLock; }
+
     QAudio::Role m_audioRole;
     std::shared_ptr<lomiri::MediaHub::Player> m_hubPlayerSession;
+    AalBackendLock *m_backendLock;
 };
 
 #endif // AALAUDIOROLECONTROL_H
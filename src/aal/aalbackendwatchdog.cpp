@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aalbackendwatchdog.h"
+#include "aallogging.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QMutexLocker>
+
+namespace
+{
+const qint64 DefaultBudgetMs = 4;
+}
+
+AalBackendWatchdog::AalBackendWatchdog()
+    : m_budgetNs(DefaultBudgetMs * 1000000),
+      m_slowCallCount(0)
+{
+    bool ok = false;
+    const qint64 budgetMs = qgetenv("QTUBUNTU_MEDIA_CALL_BUDGET_MS").toLongLong(&ok);
+    if (ok && budgetMs > 0)
+        m_budgetNs = budgetMs * 1000000;
+
+    m_history.reserve(HistorySize);
+}
+
+AalBackendWatchdog *AalBackendWatchdog::instance()
+{
+    static AalBackendWatchdog watchdog;
+    return &watchdog;
+}
+
+QVector<AalBackendCall> AalBackendWatchdog::slowCalls() const
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_history.size() < HistorySize)
+        return m_history;
+
+    // The history is full, the oldest entry is the next one to be replaced
+    const int oldest = m_slowCallCount % HistorySize;
+    return m_history.mid(oldest) + m_history.mid(0, oldest);
+}
+
+quint64 AalBackendWatchdog::slowCallCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_slowCallCount;
+}
+
+void AalBackendWatchdog::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_history.clear();
+    m_slowCallCount = 0;
+}
+
+void AalBackendWatchdog::report(const char *call, const char *caller, qint64 durationNs)
+{
+    const AalBackendCall slowCall = { call, caller, durationNs / 1000,
+                                      QDateTime::currentMSecsSinceEpoch() };
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_history.size() < HistorySize)
+            m_history.append(slowCall);
+        else
+            m_history[m_slowCallCount % HistorySize] = slowCall;
+        ++m_slowCallCount;
+    }
+
+    qCWarning(aalIpc) << "media-hub call" << call << "from" << caller << "took"
+               << slowCall.durationUs << "us, budget is" << budgetUs() << "us";
+    Q_EMIT slowCallDetected(QString::fromLatin1(call), QString::fromLatin1(caller),
+                            slowCall.durationUs);
+}
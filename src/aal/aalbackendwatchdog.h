@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AALBACKENDWATCHDOG_H
+#define AALBACKENDWATCHDOG_H
+
+#include "aaltracer.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+#include <atomic>
+
+// A media-hub call that took longer than the budget
+struct AalBackendCall
+{
+    // Both point to string literals
+    const char *call;
+    const char *caller;
+    qint64 durationUs;
+    // Milliseconds since the epoch
+    qint64 timestamp;
+};
+
+// Keeps track of backend calls that block their thread for longer than the
+// budget, 4 ms unless QTUBUNTU_MEDIA_CALL_BUDGET_MS says otherwise. Use the
+// AAL_BACKEND_CALL() macro around every call into media-hub.
+class AalBackendWatchdog : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Slow calls that are remembered
+    static const int HistorySize = 64;
+
+    static AalBackendWatchdog *instance();
+
+    qint64 budgetUs() const { return m_budgetNs / 1000; }
+    void setBudgetUs(qint64 budget) { m_budgetNs = budget * 1000; }
+
+    // Oldest first
+    QVector<AalBackendCall> slowCalls() const;
+    // Including those that dropped out of the history
+    quint64 slowCallCount() const;
+    void clear();
+
+    // Called by AalBackendCallTimer
+    void check(const char *call, const char *caller, qint64 durationNs)
+    {
+        if (Q_UNLIKELY(durationNs > m_budgetNs))
+            report(call, caller, durationNs);
+    }
+
+Q_SIGNALS:
+    // Emitted from the thread the call was made from
+    void slowCallDetected(const QString &call, const QString &caller, qint64 durationUs);
+
+private:
+    AalBackendWatchdog();
+
+    void report(const char *call, const char *caller, qint64 durationNs);
+
+    std::atomic<qint64> m_budgetNs;
+
+    mutable QMutex m_mutex;
+    QVector<AalBackendCall> m_history;
+    quint64 m_slowCallCount;
+};
+
+// The media-hub client objects are not thread-safe. Each session has a
+// lock of its own, enabled while a threaded AalPlayerCommandQueue sends to
+// the session from its worker thread. Every call into the session holds
+// it then, so the worker never calls into it while another thread does.
+// Calls into other sessions don't wait for it.
+class AalBackendLock
+{
+public:
+    AalBackendLock() : m_mutex(QMutex::Recursive), m_enabled(false) {}
+
+    void setEnabled(bool enabled) { m_enabled = enabled; }
+    bool isEnabled() const { return m_enabled.load(); }
+
+    // Recursive, backend calls may nest
+    QMutex *mutex() { return &m_mutex; }
+
+private:
+    Q_DISABLE_COPY(AalBackendLock)
+
+    QMutex m_mutex;
+    std::atomic<bool> m_enabled;
+};
+
+// Times a backend call from construction until it goes out of scope,
+// including the wait for AalBackendLock. The call also shows up in traces,
+// see AalTracer.
+class AalBackendCallTimer
+{
+public:
+    // lock may be null for calls that don't need one
+    AalBackendCallTimer(const char *call, const char *caller, AalBackendLock *lock = nullptr)
+        : m_call(call),
+          m_caller(caller),
+          m_lock(lock != nullptr && lock->isEnabled() ? lock->mutex() : nullptr)
+    {
+        m_timer.start();
+        if (Q_UNLIKELY(m_lock != nullptr))
+            m_lock->lock();
+    }
+
+    ~AalBackendCallTimer()
+    {
+        if (Q_UNLIKELY(m_lock != nullptr))
+            m_lock->unlock();
+        const qint64 durationNs = m_timer.nsecsElapsed();
+        AalBackendWatchdog::instance()->check(m_call, m_caller, durationNs);
+        if (Q_UNLIKELY(AalTracer::isEnabled())) {
+            const double duration = durationNs / 1000.0;
+            AalTracer::instance()->complete(m_call, "ipc", AalTracer::now() - duration, duration);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(AalBackendCallTimer)
+
+    const char *m_call;
+    const char *m_caller;
+    QMutex *const m_lock;
+    QElapsedTimer m_timer;
+};
+
+// Times the rest of the enclosing scope, 'call' names the media-hub method.
+// Takes the lock of the session the call goes to from a backendLock() in
+// scope, see AalBackendLock.
+#define AAL_BACKEND_CALL(call) \
+    AalBackendCallTimer aalBackendCallTimer(call, Q_FUNC_INFO, backendLock())
+
+#endif // AALBACKENDWATCHDOG_H
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aalflightrecorder.h"
+#include "aallogging.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QSaveFile>
+
+#include <chrono>
+
+namespace
+{
+qint64 steadyClockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
+
+const int AalFlightRecorder::Capacity;
+const char AalFlightRecorder::Magic[8] = { 'A', 'A', 'L', 'F', 'R', 'E', 'C', '\0' };
+const quint32 AalFlightRecorder::FormatVersion;
+
+AalFlightRecorder::AalFlightRecorder()
+    : m_next(0)
+{
+    for (Slot &slot : m_slots)
+        slot.sequence.store(0, std::memory_order_relaxed);
+}
+
+void AalFlightRecorder::record(EventType type, qint64 value, qint64 detail)
+{
+    const quint64 sequence = m_next.fetch_add(1, std::memory_order_relaxed) + 1;
+    Slot &slot = m_slots[(sequence - 1) % Capacity];
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.timestamp.store(steadyClockNs(), std::memory_order_relaxed);
+    slot.type.store(type, std::memory_order_relaxed);
+    slot.value.store(value, std::memory_order_relaxed);
+    slot.detail.store(detail, std::memory_order_relaxed);
+    slot.sequence.store(sequence, std::memory_order_release);
+}
+
+QVector<AalFlightRecorder::Event> AalFlightRecorder::events() const
+{
+    const quint64 last = m_next.load(std::memory_order_acquire);
+    const quint64 first = last > quint64(Capacity) ? last - Capacity + 1 : 1;
+
+    QVector<Event> events;
+    events.reserve(last - first + 1);
+    for (quint64 sequence = first; sequence <= last; ++sequence) {
+        const Slot &slot = m_slots[(sequence - 1) % Capacity];
+        if (slot.sequence.load(std::memory_order_acquire) != sequence)
+            continue;
+
+        const Event event = {
+            sequence,
+            slot.timestamp.load(std::memory_order_relaxed),
+            static_cast<EventType>(slot.type.load(std::memory_order_relaxed)),
+            slot.value.load(std::memory_order_relaxed),
+            slot.detail.load(std::memory_order_relaxed)
+        };
+
+        // A writer got to the slot while it was being read
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+            continue;
+
+        events.append(event);
+    }
+    return events;
+}
+
+int AalFlightRecorder::internName(const QString &name)
+{
+    const int index = m_names.indexOf(name);
+    if (index >= 0)
+        return index;
+
+    m_names.append(name);
+    return m_names.size() - 1;
+}
+
+bool AalFlightRecorder::dump(const QString &fileName) const
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(aalPlayer) << "Failed to open" << fileName << "for the flight recorder dump:"
+                   << file.errorString();
+        return false;
+    }
+
+    const QVector<Event> recorded = events();
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.writeRawData(Magic, sizeof(Magic));
+    out << FormatVersion;
+    // Lets the decoder turn timestamps into wall clock time
+    out << QDateTime::currentMSecsSinceEpoch() << steadyClockNs();
+    out << m_names;
+    out << quint32(recorded.size());
+    for (const Event &event : recorded) {
+        out << event.sequence << event.timestamp << quint16(event.type)
+            << event.value << event.detail;
+    }
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        qCWarning(aalPlayer) << "Failed to write the flight recorder dump to" << fileName;
+        return false;
+    }
+
+    qCDebug(aalPlayer) << "Wrote" << recorded.size() << "flight recorder events to" << fileName;
+    return true;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AALFLIGHTRECORDER_H
+#define AALFLIGHTRECORDER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+
+// Remembers the latest Capacity player events, so that a stutter or a stuck
+// playlist can be looked into after the fact. Recording an event takes no
+// lock and can be done from any thread, e.g. the one frames arrive on.
+//
+// Dumps are decoded with tools/flightrecorder.
+class AalFlightRecorder
+{
+public:
+    // Values are part of the dump format, only ever append
+    enum EventType
+    {
+        // value: QMediaPlayer::State
+        StateChanged = 1,
+        // value: QMediaPlayer::MediaStatus
+        MediaStatusChanged = 2,
+        // value: lomiri::MediaHub::Player::PlaybackStatus
+        PlaybackStatusChanged = 3,
+        // value: target position in microseconds
+        Seek = 4,
+        // value: stream time of the frame in microseconds, -1 if unknown
+        FramePresented = 5,
+        // value: buffered percentage
+        Buffering = 6,
+        // value: index of the new current track
+        TrackChanged = 7,
+        // value: QMediaPlayer::Error
+        Error = 8,
+        // value: duration in microseconds, detail: index into names()
+        BackendCall = 9
+    };
+
+    struct Event
+    {
+        quint64 sequence;
+        // Nanoseconds on the monotonic clock
+        qint64 timestamp;
+        EventType type;
+        qint64 value;
+        qint64 detail;
+    };
+
+    static const int Capacity = 2048;
+
+    // First bytes of a dump, followed by FormatVersion
+    static const char Magic[8];
+    static const quint32 FormatVersion = 1;
+
+    AalFlightRecorder();
+
+    void record(EventType type, qint64 value = 0, qint64 detail = 0);
+
+    // Oldest first. Events that are being overwritten while this runs are
+    // left out.
+    QVector<Event> events() const;
+    quint64 recordedEvents() const { return m_next.load(std::memory_order_relaxed); }
+
+    // Strings events can refer to by index. Unlike record(), this must only
+    // be called from the thread the recorder belongs to.
+    int internName(const QString &name);
+    QStringList names() const { return m_names; }
+
+    bool dump(const QString &fileName) const;
+
+private:
+    Q_DISABLE_COPY(AalFlightRecorder)
+
+    // The sequence number is zero while the slot is being written
+    struct Slot
+    {
+        std::atomic<quint64> sequence;
+        std::atomic<qint64> timestamp;
+        std::atomic<int> type;
+        std::atomic<qint64> value;
+        std::atomic<qint64> detail;
+    };
+
+    std::atomic<quint64> m_next;
+    Slot m_slots[Capacity];
+    QStringList m_names;
+};
+
+#endif // AALFLIGHTRECORDER_H
@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aallogging.h"
+
+Q_LOGGING_CATEGORY(aalPlayer, "aal.player", QtWarningMsg)
+Q_LOGGING_CATEGORY(aalRenderer, "aal.renderer", QtWarningMsg)
+Q_LOGGING_CATEGORY(aalPlaylist, "aal.playlist", QtWarningMsg)
+Q_LOGGING_CATEGORY(aalIpc, "aal.ipc", QtWarningMsg)
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AALLOGGING_H
+#define AALLOGGING_H
+
+#include <QLoggingCategory>
+
+// Debug messages are off unless enabled with e.g.
+// QT_LOGGING_RULES="aal.*.debug=true". A disabled message costs a check of
+// a flag, its arguments aren't evaluated.
+//
+// Messages on paths QML polls many times per second, like the
+// AalMediaPlayerControl getters, are only built with VERBOSE_DEBUG.
+Q_DECLARE_LOGGING_CATEGORY(aalPlayer)
+Q_DECLARE_LOGGING_CATEGORY(aalRenderer)
+Q_DECLARE_LOGGING_CATEGORY(aalPlaylist)
+// Talking to media-hub
+Q_DECLARE_LOGGING_CATEGORY(aalIpc)
+
+#endif // AALLOGGING_H
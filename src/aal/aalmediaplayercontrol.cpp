@@ -15,6 +15,7 @@
  */
 
 #include "aalmediaplayercontrol.h"
+#include "aallogging.h"
 #include "aalmediaplayerservice.h"
 #include "aalvideorenderercontrol.h"
 #include "aalutility.h"
@@ -26,6 +27,13 @@
 #include <QApplication>
 #include <QTimer>
 
+namespace
+{
+// How long media-hub gets to confirm play(), pause() or stop() before the
+// state it reports is taken as it is
+const int StateSettleTimeoutMs = 3000;
+}
+
 AalMediaPlayerControl::AalMediaPlayerControl(AalMediaPlayerService *service, QObject *parent)
    : QMediaPlayerControl(parent),
     m_service(service),
@@ -33,8 +41,15 @@ AalMediaPlayerControl::AalMediaPlayerControl(AalMediaPlayerService *service, QOb
     m_status(QMediaPlayer::NoMedia),
     m_cachedDuration(0),
     m_applicationActive(true),
-    m_allowSeek(true)
+    m_allowSeek(true),
+    m_commandSequence(0),
+    m_backendState(QMediaPlayer::StoppedState),
+    m_settleDeferred(false)
 {
+    m_settleTimer.setSingleShot(true);
+    m_settleTimer.setInterval(StateSettleTimeoutMs);
+    connect(&m_settleTimer, &QTimer::timeout, this, &AalMediaPlayerControl::onSettleTimeout);
+
     m_cachedVolume = volume();
 
     QApplication::instance()->installEventFilter(this);
@@ -51,13 +66,17 @@ AalMediaPlayerControl::~AalMediaPlayerControl()
 
 QMediaPlayer::State AalMediaPlayerControl::state() const
 {
-    qDebug() << __PRETTY_FUNCTION__ << endl;
+#ifdef VERBOSE_DEBUG
+    qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
+#endif
     return m_state;
 }
 
 QMediaPlayer::MediaStatus AalMediaPlayerControl::mediaStatus() const
 {
-    qDebug() << __PRETTY_FUNCTION__ << endl;
+#ifdef VERBOSE_DEBUG
+    qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
+#endif
     return m_status;
 }
 
@@ -68,7 +87,7 @@ QAudio::Role AalMediaPlayerControl::audioRole() const
 
 void AalMediaPlayerControl::setAudioRole(QAudio::Role audioRole)
 {
-    qDebug() << __PRETTY_FUNCTION__;
+    qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
     m_service->setAudioRole(audioRole);
 }
 
@@ -194,18 +213,18 @@ const QIODevice* AalMediaPlayerControl::mediaStream() const
 void AalMediaPlayerControl::setMedia(const QMediaContent& media, QIODevice* stream)
 {
     Q_UNUSED(stream);
-    qDebug() << __PRETTY_FUNCTION__ << endl;
+    qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
 
     const QUrl mediaUrl =
             AalUtility::unescape(media);
     const lomiri::MediaHub::Player::Headers headers =
             AalUtility::extractHeaders(media.canonicalRequest());
 
-    qDebug() << "setMedia() media: " << mediaUrl;
-    qDebug() << "setMedia() headers empty: " << headers.empty();
+    qCDebug(aalPlayer) << "setMedia() media: " << mediaUrl;
+    qCDebug(aalPlayer) << "setMedia() headers empty: " << headers.empty();
 
     if (m_mediaContent == media) {
-        qDebug() << "Same media as current";
+        qCDebug(aalPlayer) << "Same media as current";
         return;
     }
 
@@ -230,33 +249,28 @@ void AalMediaPlayerControl::setMedia(const QMediaContent& media, QIODevice* stre
 
 void AalMediaPlayerControl::play()
 {
-    qDebug() << __PRETTY_FUNCTION__ << endl;
+    qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
+    requestState(QMediaPlayer::PlayingState);
     m_service->play();
-
-    // FIXME: Why are these setState needed? State is changed also when signals
-    // from media-hub are received, which seems the right way to track it.
-    setState(QMediaPlayer::PlayingState);
 }
 
 void AalMediaPlayerControl::pause()
 {
-    qDebug() << __PRETTY_FUNCTION__ << endl;
+    qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
+    requestState(QMediaPlayer::PausedState);
     m_service->pause();
-
-    setState(QMediaPlayer::PausedState);
 }
 
 void AalMediaPlayerControl::stop()
 {
-    qDebug() << __PRETTY_FUNCTION__ << endl;
+    qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
+    requestState(QMediaPlayer::StoppedState);
     m_service->stop();
-
-    setState(QMediaPlayer::StoppedState);
 }
 
 void AalMediaPlayerControl::playbackComplete()
 {
-    qDebug() << __PRETTY_FUNCTION__ << endl;
+    qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
     // The order of these lines is very important to keep music-app,
     // mediaplayer-app and the QMediaPlaylist loop cases all happy
     setMediaStatus(QMediaPlayer::EndOfMedia);
@@ -265,8 +279,8 @@ void AalMediaPlayerControl::playbackComplete()
         stop();
     m_service->setPosition(0);
     Q_EMIT positionChanged(position());
-    if (isVideoAvailable())
-        m_service->resetVideoSink();
+    // The video sink and texture are kept for replaying, they only get
+    // released when different media is set
 }
 
 void AalMediaPlayerControl::mediaPrepared()
@@ -291,10 +305,125 @@ void AalMediaPlayerControl::setMediaStatus(QMediaPlayer::MediaStatus status)
     if (status != m_status)
     {
         m_status = status;
+        m_service->flightRecorder().record(AalFlightRecorder::MediaStatusChanged, status);
         Q_EMIT mediaStatusChanged(m_status);
     }
 }
 
+void AalMediaPlayerControl::requestState(QMediaPlayer::State state)
+{
+    const QMediaPlayer::State headedFor =
+            m_unconfirmedCommands.isEmpty() ? m_backendState : m_unconfirmedCommands.last().target;
+
+    // media-hub won't report anything for a command that changes nothing
+    if (state != headedFor)
+    {
+        const PendingCommand command = { ++m_commandSequence, state };
+        m_unconfirmedCommands.enqueue(command);
+        m_settleDeferred = false;
+        m_settleTimer.start();
+    }
+
+    // Apps expect the state to follow their calls right away, media-hub
+    // takes a round trip to confirm it
+    if (state != m_state)
+        setState(state);
+}
+
+void AalMediaPlayerControl::updateBackendState(QMediaPlayer::State state)
+{
+    m_backendState = state;
+
+    if (!m_unconfirmedCommands.isEmpty())
+    {
+        // On the way to what the oldest command asked for, e.g. Ready
+        // before Playing
+        const PendingCommand &oldest = m_unconfirmedCommands.head();
+        if (state != oldest.target && isIntermediateState(state, oldest.target))
+        {
+            qCDebug(aalPlayer) << "Ignoring intermediate state" << state << "of command"
+                               << oldest.sequence;
+            return;
+        }
+
+        // The state reached confirms the first command that asked for it,
+        // along with the ones before it media-hub didn't report on
+        int confirmed = -1;
+        for (int i = 0; i < m_unconfirmedCommands.size(); ++i)
+        {
+            if (m_unconfirmedCommands.at(i).target == state)
+            {
+                confirmed = i;
+                break;
+            }
+        }
+
+        if (confirmed >= 0)
+        {
+            const quint64 command = m_unconfirmedCommands.at(confirmed).sequence;
+            m_unconfirmedCommands.erase(m_unconfirmedCommands.begin(),
+                                        m_unconfirmedCommands.begin() + confirmed + 1);
+            // E.g. the Playing that follows a quick play() and pause(). The
+            // state the last command asked for is already shown.
+            if (!m_unconfirmedCommands.isEmpty())
+            {
+                qCDebug(aalPlayer) << "Ignoring state" << state << "of command" << command
+                                   << ", waiting for" << m_unconfirmedCommands.last().sequence;
+                return;
+            }
+
+            m_settleTimer.stop();
+            m_settleDeferred = false;
+            if (state != m_state)
+                setState(state);
+            return;
+        }
+
+        // media-hub went somewhere nobody asked for, e.g. because the
+        // stream ended or failed. That overrides the commands.
+        qCDebug(aalPlayer) << "media-hub changed to state" << state << "on its own, dropping"
+                           << m_unconfirmedCommands.size() << "commands";
+        m_unconfirmedCommands.clear();
+        m_settleTimer.stop();
+        m_settleDeferred = false;
+    }
+
+    setState(state);
+}
+
+bool AalMediaPlayerControl::isIntermediateState(QMediaPlayer::State state,
+                                                QMediaPlayer::State target)
+{
+    // media-hub reports Ready as Paused while it prepares to play, and
+    // passes through Paused when it winds playback down
+    return state == QMediaPlayer::PausedState && target != QMediaPlayer::PausedState;
+}
+
+void AalMediaPlayerControl::deferSettling()
+{
+    m_settleDeferred = true;
+    m_settleTimer.stop();
+}
+
+void AalMediaPlayerControl::resumeSettling()
+{
+    if (!m_settleDeferred)
+        return;
+
+    m_settleDeferred = false;
+    if (!m_unconfirmedCommands.isEmpty())
+        m_settleTimer.start();
+}
+
+void AalMediaPlayerControl::onSettleTimeout()
+{
+    qCWarning(aalPlayer) << "media-hub didn't confirm" << m_unconfirmedCommands.size()
+                         << "commands, its state is" << m_backendState;
+    m_unconfirmedCommands.clear();
+    if (m_backendState != m_state)
+        setState(m_backendState);
+}
+
 void AalMediaPlayerControl::setState(QMediaPlayer::State state)
 {
     // Because QMediaPlayer doesn't have a Ready state and GStreamer does, make sure the
@@ -303,6 +432,7 @@ void AalMediaPlayerControl::setState(QMediaPlayer::State state)
     if (state != m_state || do_state_changed)
     {
         m_state = state;
+        m_service->flightRecorder().record(AalFlightRecorder::StateChanged, state);
         Q_EMIT stateChanged(m_state);
     }
 }
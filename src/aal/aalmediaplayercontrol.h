@@ -18,6 +18,8 @@
 #define AALMEDIAPLAYER_H
 
 #include <QMediaPlayerControl>
+#include <QQueue>
+#include <QTimer>
 #include <QtMultimedia/qaudio.h>
 
 class AalMediaPlayerService;
@@ -59,10 +61,24 @@ public:
     void mediaPrepared();
     void emitDurationChanged(qint64 duration);
 
+    // The state media-hub reports. Ignored while it is still catching up
+    // with play(), pause() or stop(), unless it's somewhere none of them
+    // lead to.
+    void updateBackendState(QMediaPlayer::State state);
+    // play(), pause() and stop() calls media-hub hasn't confirmed yet
+    int pendingCommands() const { return m_unconfirmedCommands.size(); }
+    // The pending play() waits for the video output before it is sent to
+    // media-hub, so it can't be expected to be confirmed until then
+    void deferSettling();
+    void resumeSettling();
+
 public Q_SLOTS:
     void debounceSeek();
     void playbackComplete();
 
+private Q_SLOTS:
+    void onSettleTimeout();
+
 private:
     AalMediaPlayerService *m_service;
     QMediaPlayer::State m_state;
@@ -75,10 +91,30 @@ private:
     bool m_applicationActive;
     bool m_allowSeek;
 
+    // Every play(), pause() and stop() that changes the state media-hub is
+    // headed for gets the next sequence number. It is confirmed once
+    // media-hub reports the state it asked for.
+    struct PendingCommand
+    {
+        quint64 sequence;
+        QMediaPlayer::State target;
+    };
+    quint64 m_commandSequence;
+    QQueue<PendingCommand> m_unconfirmedCommands;
+    QMediaPlayer::State m_backendState;
+    // Gives up on media-hub confirming the pending command
+    QTimer m_settleTimer;
+    // See deferSettling()
+    bool m_settleDeferred;
+
     void updateCachedDuration(qint64 duration);
     QUrl unescape(const QMediaContent &media) const;
     void setMediaStatus(QMediaPlayer::MediaStatus status);
     void setState(QMediaPlayer::State state);
+    // Shows the state a command asks for right away
+    void requestState(QMediaPlayer::State state);
+    // Whether media-hub passes through state on its way to target
+    static bool isIntermediateState(QMediaPlayer::State state, QMediaPlayer::State target);
 };
 
 #endif
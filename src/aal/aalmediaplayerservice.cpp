@@ -19,6 +19,10 @@
 #include "aalmediaplaylistcontrol.h"
 #include "aalmediaplaylistprovider.h"
 #include "aalaudiorolecontrol.h"
+#include "aalbackendwatchdog.h"
+#include "aallogging.h"
+#include "aalplayercommandqueue.h"
+#include "aaltracer.h"
 #include "aalutility.h"
 
 #include <qmediaplaylistcontrol_p.h>
@@ -29,23 +33,15 @@
 #include <errno.h>
 
 #include <QAbstractVideoSurface>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QGuiApplication>
 #include <QTimerEvent>
 #include <QThread>
 
 #include <qtubuntu_media_signals.h>
 
-// Uncomment to re-enable media-hub Player session detach/reattach functionality.
-// It is not clear at all whether we should do this or not, as detaching
-// is probably something that should be done when the app finishes, not when it
-// simply moves to the background.
-//#define DO_PLAYER_ATTACH_DETACH
-
-// Defined in aalvideorenderercontrol.h
-#ifdef MEASURE_PERFORMANCE
-#include <QDateTime>
-#endif
-
 #include <QDebug>
 
 namespace media = lomiri::MediaHub;
@@ -57,12 +53,28 @@ enum {
     NO_ERROR    = 0,
     BAD_VALUE   = -EINVAL,
 };
+
+// Restoring a detached session should go unnoticed when the app comes back
+const qint64 ResumeLatencyTargetMs = 100;
+
+// Retries of recreating the session after media-hub restarted back off
+// exponentially, up to a few seconds apart
+const int RecoveryFirstRetryMs = 100;
+const int RecoveryMaxRetryMs = 5000;
+const int RecoveryMaxAttempts = 8;
+
+// While playing, the position last pushed by media-hub is moved on by the
+// time since. Once it's older than this, media-hub gets asked instead, in
+// case it stopped pushing positions.
+const qint64 PositionCacheMaxAgeMs = 1000;
+const int DefaultPositionGranularityMs = 1000;
 }
 
 AalMediaPlayerService::AalMediaPlayerService(QObject *parent)
     :
      QMediaService(parent),
      m_hubPlayerSession(nullptr),
+     m_commandQueue(new AalPlayerCommandQueue(qgetenv("QTUBUNTU_MEDIA_IPC_THREAD") == "1", this)),
      m_mediaPlayerControl(nullptr),
      m_videoOutput(nullptr),
      m_mediaPlaylistControl(nullptr),
@@ -71,9 +83,20 @@ AalMediaPlayerService::AalMediaPlayerService(QObject *parent)
      m_videoOutputReady(false),
      m_firstPlayback(true),
      m_cachedDuration(0),
+     m_volume(1.0),
      m_mediaPlaylist(nullptr),
+     m_newStatus(media::Player::PlaybackStatus::Null),
      m_bufferPercent(0),
-     m_doReattachSession(false)
+     m_cachedPosition(-1),
+     m_positionGranularity(DefaultPositionGranularityMs),
+     m_notifiedPosition(-1),
+     m_pendingSeek(-1),
+     m_detachOnSuspend(qgetenv("QTUBUNTU_MEDIA_DETACH_ON_SUSPEND") == "1"),
+     m_sessionDetached(false),
+     m_resumeLatency(-1),
+     m_recoveryAttempts(0),
+     m_recoveryTime(-1),
+     m_flightRecorderDir(QString::fromLocal8Bit(qgetenv("QTUBUNTU_MEDIA_FLIGHT_RECORDER_DIR")))
 #ifdef MEASURE_PERFORMANCE
       , m_lastFrameDecodeStart(0)
       , m_currentFrameDecodeStart(0)
@@ -81,6 +104,27 @@ AalMediaPlayerService::AalMediaPlayerService(QObject *parent)
       , m_frameDecodeAvg(0)
 #endif
 {
+    bool ok = false;
+    const int granularity = qgetenv("QTUBUNTU_MEDIA_POSITION_GRANULARITY_MS").toInt(&ok);
+    if (ok)
+        setPositionGranularity(granularity);
+
+    m_recoveryTimer.setSingleShot(true);
+    connect(&m_recoveryTimer, &QTimer::timeout, this, &AalMediaPlayerService::recoverSession);
+
+    // Emitted from the worker thread, so this is queued
+    connect(m_commandQueue, &AalPlayerCommandQueue::stateRefreshed,
+            this, &AalMediaPlayerService::onStateRefreshed);
+
+    // Slow calls are recorded by every service, they may well be what held
+    // this one up
+    connect(AalBackendWatchdog::instance(), &AalBackendWatchdog::slowCallDetected, this,
+            [this](const QString &call, const QString &caller, qint64 durationUs) {
+                Q_UNUSED(caller);
+                m_flightRecorder.record(AalFlightRecorder::BackendCall, durationUs,
+                                        m_flightRecorder.internName(call));
+            });
+
     constructNewPlayerService();
     // Note: this must be in the constructor and not part of constructNewPlayerService()
     // or it won't successfully connect to the signal
@@ -108,29 +152,17 @@ AalMediaPlayerService::~AalMediaPlayerService()
 void AalMediaPlayerService::constructNewPlayerService()
 {
     if (!newMediaPlayer())
-        qWarning() << "Failed to create a new media player backend. Video playback will not function." << endl;
+        qCWarning(aalPlayer) << "Failed to create a new media player backend. Video playback will not function.";
 
     if (m_hubPlayerSession == nullptr)
     {
-        qWarning() << "Could not finish contructing new AalMediaPlayerService instance since m_hubPlayerSession is NULL";
+        qCWarning(aalPlayer) << "Could not finish contructing new AalMediaPlayerService instance since m_hubPlayerSession is NULL";
         return;
     }
 
     createMediaPlayerControl();
     createVideoRendererControl();
     createAudioRoleControl();
-
-    QObject::connect(m_hubPlayerSession.get(), &media::Player::playbackStatusChanged,
-                     this, &AalMediaPlayerService::onPlaybackStatusChanged);
-
-    QObject::connect(m_hubPlayerSession.get(), &media::Player::bufferingChanged, this,
-                [this](int bufferingPercent) {
-                    m_bufferPercent = bufferingPercent;
-                    onBufferingChanged();
-                });
-
-    QObject::connect(m_hubPlayerSession.get(), &media::Player::errorOccurred,
-                     this, &AalMediaPlayerService::onError);
 }
 
 QMediaControl *AalMediaPlayerService::requestControl(const char *name)
@@ -186,34 +218,58 @@ bool AalMediaPlayerService::newMediaPlayer()
     if (m_hubPlayerSession != nullptr)
         return true;
 
-    m_hubPlayerSession.reset(new media::Player());
+    {
+        AAL_BACKEND_CALL("Player::Player");
+        m_hubPlayerSession.reset(new media::Player());
+    }
 
     // Get the player session UUID so we can suspend/restore our session when the ApplicationState
     // changes
-    m_sessionUuid = m_hubPlayerSession->uuid();
+    {
+        AAL_BACKEND_CALL("Player::uuid");
+        m_sessionUuid = m_hubPlayerSession->uuid();
+    }
+
+    // media-hub didn't create a session for us, e.g. because it isn't up (yet)
+    if (m_sessionUuid.isEmpty())
+    {
+        qCWarning(aalPlayer) << "media-hub failed to create a player session";
+        m_hubPlayerSession = nullptr;
+        return false;
+    }
+
+    m_commandQueue->setPlayer(m_hubPlayerSession);
     return true;
 }
 
 lomiri::MediaHub::VideoSink &AalMediaPlayerService::createVideoSink(uint32_t texture_id)
 {
+    AAL_TRACE_SCOPE("createVideoSink", "player");
     m_videoOutputReady = true;
+    AAL_BACKEND_CALL("Player::createGLTextureVideoSink");
     return m_hubPlayerSession->createGLTextureVideoSink(texture_id);
 }
 
+bool AalMediaPlayerService::canMapVideoFrames() const
+{
+    // A dynamic property, so reading it stays on this side
+    return m_hubPlayerSession && m_hubPlayerSession->property("mappableVideoSinks").toBool();
+}
+
 void AalMediaPlayerService::resetVideoSink()
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlayer) << Q_FUNC_INFO;
     Q_EMIT SharedSignal::instance()->sinkReset();
     m_firstPlayback = false;
     if (m_videoOutput != NULL)
-        m_videoOutput->playbackComplete();
+        m_videoOutput->releaseVideoSink();
 }
 
 QAudio::Role AalMediaPlayerService::audioRole() const
 {
     if (m_audioRoleControl == nullptr)
     {
-        qWarning() << "Failed to get audio role, m_audioRoleControl is NULL";
+        qCWarning(aalPlayer) << "Failed to get audio role, m_audioRoleControl is NULL";
         return QAudio::UnknownRole;
     }
 
@@ -224,7 +280,7 @@ void AalMediaPlayerService::setAudioRole(QAudio::Role audioRole)
 {
     if (m_audioRoleControl == nullptr)
     {
-        qWarning() << "Failed to set audio role, m_audioRoleControl is NULL";
+        qCWarning(aalPlayer) << "Failed to set audio role, m_audioRoleControl is NULL";
         return;
     }
 
@@ -235,12 +291,12 @@ void AalMediaPlayerService::setMediaPlaylist(const QMediaPlaylist &playlist)
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot set playlist without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot set playlist without a valid media-hub player session";
         return;
     }
     if (playlist.mediaCount() == 0)
     {
-        qWarning() << "Failed to set background playlist, list is empty." << endl;
+        qCWarning(aalPlayer) << "Failed to set background playlist, list is empty.";
         return;
     }
 
@@ -250,9 +306,10 @@ void AalMediaPlayerService::setMediaPlaylist(const QMediaPlaylist &playlist)
 void AalMediaPlayerService::setMedia(const QUrl &url,
                                      const lomiri::MediaHub::Player::Headers &headers)
 {
+    AAL_TRACE_SCOPE("setMedia", "player");
     if (m_hubPlayerSession == nullptr)
     {
-        qWarning() << "Cannot open uri without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot open uri without a valid media-hub player session";
         return;
     }
 
@@ -264,7 +321,10 @@ void AalMediaPlayerService::setMedia(const QUrl &url,
         resetVideoSink();
     }
 
-    qDebug() << "Setting media to: " << url;
+    qCDebug(aalPlayer) << "Setting media to: " << url;
+    m_mediaUri = url;
+    m_mediaHeaders = headers;
+    invalidateCachedPosition();
 
     if (m_mediaPlaylistProvider && url.isEmpty())
         m_mediaPlaylistProvider->clear();
@@ -272,7 +332,7 @@ void AalMediaPlayerService::setMedia(const QUrl &url,
     if (m_mediaPlaylistProvider == nullptr || m_mediaPlaylistProvider->mediaCount() == 0)
     {
         // errors are delivered via Player::errorOccurred()
-        m_hubPlayerSession->openUri(url, headers);
+        m_commandQueue->openUri(url, headers);
     }
 
     m_videoOutput->setupSurface();
@@ -280,10 +340,11 @@ void AalMediaPlayerService::setMedia(const QUrl &url,
 
 void AalMediaPlayerService::play()
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlayer) << Q_FUNC_INFO;
+    AAL_TRACE_SCOPE("play", "player");
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot start playback without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot start playback without a valid media-hub player session";
         return;
     }
 
@@ -296,78 +357,115 @@ void AalMediaPlayerService::play()
     }
 
     // If we previously played and hit the end-of-stream, stop will be called which
-    // tears down the video sink. We need a new video sink in order to render video again
-    if (!m_videoOutputReady && m_videoOutput->textureId() > 0)
-    {
-        createVideoSink(m_videoOutput->textureId());
-    }
+    // tears down the video sink. The texture is kept across replays, so the sink
+    // is re-armed in place instead of negotiating a new texture with qtvideo-node
+    if (!m_videoOutputReady && m_videoOutput != NULL)
+        m_videoOutput->rearmVideoSink();
 
     if (m_videoOutputReady || isAudioSource())
     {
         m_mediaPlayerControl->setMediaStatus(QMediaPlayer::LoadedMedia);
 
-        qDebug() << "Actually calling m_hubPlayerSession->play()";
-        m_hubPlayerSession->play();
+        qCDebug(aalPlayer) << "Actually calling m_hubPlayerSession->play()";
+        m_commandQueue->play();
+        m_mediaPlayerControl->resumeSettling();
 
         m_mediaPlayerControl->mediaPrepared();
     }
     else
+    {
+        // Sent from AalVideoRendererControl::onGLConsumerSet()
+        m_mediaPlayerControl->deferSettling();
         Q_EMIT serviceReady();
+    }
 }
 
 void AalMediaPlayerService::pause()
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot pause playback without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot pause playback without a valid media-hub player session";
         return;
     }
 
-    m_hubPlayerSession->pause();
+    m_commandQueue->pause();
 }
 
 void AalMediaPlayerService::stop()
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot stop playback without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot stop playback without a valid media-hub player session";
         return;
     }
 
-    m_hubPlayerSession->stop();
+    m_commandQueue->stop();
     m_videoOutputReady = false;
+    invalidateCachedPosition();
 }
 
 int64_t AalMediaPlayerService::position() const
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot get current playback position without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot get current playback position without a valid media-hub player session";
         return 0;
     }
 
-    return m_hubPlayerSession->position() / 1e6;
+    if (m_cachedPosition >= 0)
+    {
+        if (m_newStatus != media::Player::PlaybackStatus::Playing)
+            return m_cachedPosition;
+
+        const qint64 age = m_positionClock.elapsed();
+        if (age < PositionCacheMaxAgeMs)
+            return m_cachedPosition + age;
+    }
+
+    // The worker thread asks instead, the answer is there next time
+    if (m_commandQueue->isThreaded()) {
+        m_commandQueue->refreshState();
+        return m_commandQueue->state().position / 1e6;
+    }
+
+    int64_t position = 0;
+    {
+        AAL_BACKEND_CALL("Player::position");
+        position = m_hubPlayerSession->position() / 1e6;
+    }
+    updateCachedPosition(position);
+    return position;
 }
 
 void AalMediaPlayerService::setPosition(int64_t msec)
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot set current playback position without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot set current playback position without a valid media-hub player session";
         return;
     }
-    m_hubPlayerSession->seekTo(msec * 1000);
+    m_flightRecorder.record(AalFlightRecorder::Seek, msec * 1000);
+    // Until media-hub confirms the seek, the position is whatever it says
+    invalidateCachedPosition();
+    m_pendingSeek = msec;
+    m_commandQueue->seekTo(msec * 1000);
 }
 
 int64_t AalMediaPlayerService::duration()
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot get playback duration without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot get playback duration without a valid media-hub player session";
         return 0;
     }
 
-    const uint64_t d = m_hubPlayerSession->duration();
+    uint64_t d = 0;
+    if (m_commandQueue->isThreaded()) {
+        d = m_commandQueue->state().duration;
+    } else {
+        AAL_BACKEND_CALL("Player::duration");
+        d = m_hubPlayerSession->duration();
+    }
     // Make sure that apps get updated if the duration does in fact change
     if (d != m_cachedDuration)
     {
@@ -381,10 +479,14 @@ bool AalMediaPlayerService::isVideoSource() const
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot check if video source without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot check if video source without a valid media-hub player session";
         return false;
     }
 
+    if (m_commandQueue->isThreaded())
+        return m_commandQueue->state().isVideoSource;
+
+    AAL_BACKEND_CALL("Player::isVideoSource");
     return m_hubPlayerSession->isVideoSource();
 }
 
@@ -392,10 +494,14 @@ bool AalMediaPlayerService::isAudioSource() const
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot if audio source without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot if audio source without a valid media-hub player session";
         return false;
     }
 
+    if (m_commandQueue->isThreaded())
+        return m_commandQueue->state().isAudioSource;
+
+    AAL_BACKEND_CALL("Player::isAudioSource");
     return m_hubPlayerSession->isAudioSource();
 }
 
@@ -403,22 +509,28 @@ int AalMediaPlayerService::getVolume() const
 {
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot get volume without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot get volume without a valid media-hub player session";
         return 0;
     }
 
-    return m_hubPlayerSession->volume();
+    // media-hub's volume goes from 0 to 1
+    if (m_commandQueue->isThreaded())
+        return qRound(m_volume * 100);
+
+    AAL_BACKEND_CALL("Player::volume");
+    return qRound(m_hubPlayerSession->volume() * 100);
 }
 
 void AalMediaPlayerService::setVolume(int volume)
 {
-    Q_UNUSED(volume);
-
     if (m_hubPlayerSession == NULL)
     {
-        qWarning() << "Cannot set volume without a valid media-hub player session";
+        qCWarning(aalPlayer) << "Cannot set volume without a valid media-hub player session";
         return;
     }
+
+    m_volume = qBound(0, volume, 100) / 100.0;
+    m_commandQueue->setVolume(m_volume);
 }
 
 void AalMediaPlayerService::createMediaPlayerControl()
@@ -441,8 +553,12 @@ void AalMediaPlayerService::createVideoRendererControl()
 void AalMediaPlayerService::createPlaylistControl()
 {
     m_mediaPlaylistControl = new AalMediaPlaylistControl(this);
+    m_mediaPlaylistControl->setBackendLock(backendLock());
     m_mediaPlaylistProvider = new AalMediaPlaylistProvider(this);
+    m_mediaPlaylistProvider->setBackendLock(backendLock());
     m_mediaPlaylistControl->setPlaylistProvider(m_mediaPlaylistProvider);
+    connect(m_mediaPlaylistControl, &AalMediaPlaylistControl::currentIndexChanged, this,
+            [this](int index) { m_flightRecorder.record(AalFlightRecorder::TrackChanged, index); });
 }
 
 void AalMediaPlayerService::createAudioRoleControl()
@@ -451,6 +567,7 @@ void AalMediaPlayerService::createAudioRoleControl()
         return;
 
     m_audioRoleControl = new AalAudioRoleControl(m_hubPlayerSession);
+    m_audioRoleControl->setBackendLock(backendLock());
 }
 
 void AalMediaPlayerService::deleteMediaPlayerControl()
@@ -472,6 +589,8 @@ void AalMediaPlayerService::destroyPlayerSession()
 
     // Invalidates the media-hub player session
     m_sessionUuid.clear();
+    // Commands still queued for the old session are of no use anymore
+    m_commandQueue->setPlayer(nullptr);
 
     // When we arrived here the session is already invalid and we
     // can safely drop the reference.
@@ -538,7 +657,10 @@ void AalMediaPlayerService::signalQMediaPlayerError(const media::Error &error)
     }
 
     if (outError != QMediaPlayer::NoError)
+    {
+        recordError(outError);
         m_mediaPlayerControl->error(outError, error.message());
+    }
 }
 
 void AalMediaPlayerService::onPlaybackStatusChanged()
@@ -548,29 +670,33 @@ void AalMediaPlayerService::onPlaybackStatusChanged()
     if (m_mediaPlayerControl == nullptr)
         return;
 
-    m_newStatus = m_hubPlayerSession->playbackStatus();
+    m_newStatus = hubPlaybackStatus();
+    m_flightRecorder.record(AalFlightRecorder::PlaybackStatusChanged, m_newStatus);
+    AAL_TRACE_INSTANT_ARG("playbackStatusChanged", "player", "status", m_newStatus);
+    // The position stops or starts moving from wherever it is right now
+    invalidateCachedPosition();
     // If the playback status changes from underneath (e.g. GStreamer or media-hub), make sure
     // the app is notified about this so it can change it's status
     switch (m_newStatus)
     {
         case media::Player::PlaybackStatus::Stopped:
-            m_mediaPlayerControl->setState(QMediaPlayer::StoppedState);
+            m_mediaPlayerControl->updateBackendState(QMediaPlayer::StoppedState);
             break;
         case media::Player::PlaybackStatus::Ready:
         case media::Player::PlaybackStatus::Paused:
-            m_mediaPlayerControl->setState(QMediaPlayer::PausedState);
+            m_mediaPlayerControl->updateBackendState(QMediaPlayer::PausedState);
             break;
         case media::Player::PlaybackStatus::Playing:
             // This is necessary in case duration == 0 right after calling play(). At this point,
             // the pipeline should be 100% prepared and playing.
             Q_EMIT m_mediaPlayerControl->durationChanged(duration());
-            m_mediaPlayerControl->setState(QMediaPlayer::PlayingState);
+            m_mediaPlayerControl->updateBackendState(QMediaPlayer::PlayingState);
             break;
         default:
-            qWarning() << "Unknown PlaybackStatus: " << m_newStatus;
+            qCWarning(aalPlayer) << "Unknown PlaybackStatus: " << m_newStatus;
     }
 
-    qDebug() << "PlaybackStatus changed to: " << playbackStatusStr(m_newStatus);
+    qCDebug(aalPlayer) << "PlaybackStatus changed to: " << playbackStatusStr(m_newStatus);
 }
 
 void AalMediaPlayerService::onApplicationStateChanged(Qt::ApplicationState state)
@@ -579,67 +705,378 @@ void AalMediaPlayerService::onApplicationStateChanged(Qt::ApplicationState state
         switch (state)
         {
             case Qt::ApplicationSuspended:
-                qDebug() << "** Application has been suspended";
+                qCDebug(aalPlayer) << "** Application has been suspended";
+                enterBackgroundMode();
+                // A playing session is kept so that audio goes on in the background
+                if (m_detachOnSuspend && m_hubPlayerSession != nullptr) {
+                    if (hubPlaybackStatus() != media::Player::PlaybackStatus::Playing)
+                        detachSession();
+                }
                 break;
             case Qt::ApplicationHidden:
-                qDebug() << "** Application is now hidden";
+                qCDebug(aalPlayer) << "** Application is now hidden";
+                enterBackgroundMode();
                 break;
             case Qt::ApplicationInactive:
-                qDebug() << "** Application is now inactive";
-#ifdef DO_PLAYER_ATTACH_DETACH
-                disconnectSignals();
-                m_hubService->detach_session(m_sessionUuid, media::Player::Client::default_configuration());
-                m_doReattachSession = true;
-#endif
+                qCDebug(aalPlayer) << "** Application is now inactive";
                 break;
             case Qt::ApplicationActive:
-                qDebug() << "** Application is now active";
-#ifdef DO_PLAYER_ATTACH_DETACH
-                // Avoid doing this for when the client application first loads as this
-                // will break video playback
-                if (m_doReattachSession)
-                {
-                    m_hubPlayerSession = m_hubService->
-                        reattach_session(m_sessionUuid,
-                                         media::Player::Client::default_configuration());
-                    // Make sure the client's status (position, duraiton, state, etc) are all
-                    // correct when reattaching to the media-hub Player session
-                    updateClientSignals();
-                    connectSignals();
-                }
-#endif
+                qCDebug(aalPlayer) << "** Application is now active";
+                if (m_sessionDetached)
+                    restoreSession();
+                leaveBackgroundMode();
                 break;
             default:
-                qDebug() << "Unknown ApplicationState";
+                qCDebug(aalPlayer) << "Unknown ApplicationState";
                 break;
         }
     } catch (const std::runtime_error &e) {
-        qWarning() << "Failed to respond to ApplicationState change: " << e.what();
+        qCWarning(aalPlayer) << "Failed to respond to ApplicationState change: " << e.what();
+    }
+}
+
+void AalMediaPlayerService::enterBackgroundMode()
+{
+    // Audio keeps playing, only video updates nobody can see are stopped
+    if (m_videoOutput == nullptr || m_hubPlayerSession == nullptr || !isVideoSource())
+        return;
+
+    m_videoOutput->enterBackground();
+}
+
+void AalMediaPlayerService::leaveBackgroundMode()
+{
+    if (m_videoOutput != nullptr)
+        m_videoOutput->leaveBackground();
+}
+
+AalSessionSnapshot AalMediaPlayerService::captureSession() const
+{
+    if (m_hubPlayerSession == nullptr)
+        return AalSessionSnapshot();
+
+    AalSessionSnapshot snapshot = captureClientState();
+    {
+        AAL_BACKEND_CALL("Player::position");
+        snapshot.position = m_hubPlayerSession->position();
+    }
+    {
+        AAL_BACKEND_CALL("Player::playbackStatus");
+        snapshot.playbackStatus = m_hubPlayerSession->playbackStatus();
+    }
+    {
+        AAL_BACKEND_CALL("Player::loopStatus");
+        snapshot.loopStatus = m_hubPlayerSession->loopStatus();
+    }
+    {
+        AAL_BACKEND_CALL("Player::shuffle");
+        snapshot.shuffle = m_hubPlayerSession->shuffle();
+    }
+    {
+        AAL_BACKEND_CALL("Player::audioStreamRole");
+        snapshot.audioRole = m_hubPlayerSession->audioStreamRole();
+    }
+    {
+        AAL_BACKEND_CALL("Player::volume");
+        snapshot.volume = m_hubPlayerSession->volume();
+    }
+    {
+        AAL_BACKEND_CALL("Player::playbackRate");
+        snapshot.playbackRate = m_hubPlayerSession->playbackRate();
+    }
+    return snapshot;
+}
+
+AalSessionSnapshot AalMediaPlayerService::captureCachedSession() const
+{
+    if (m_hubPlayerSession == nullptr)
+        return AalSessionSnapshot();
+
+    AalSessionSnapshot snapshot = captureClientState();
+
+    // Where playback was last seen, or where it was last asked to go
+    qint64 position = m_pendingSeek;
+    if (m_cachedPosition >= 0) {
+        position = m_cachedPosition;
+        if (m_newStatus == media::Player::PlaybackStatus::Playing)
+            position += m_positionClock.elapsed();
+    } else if (position < 0) {
+        position = qMax<qint64>(m_notifiedPosition, 0);
+    }
+    snapshot.position = position * 1000;
+    snapshot.playbackStatus = m_newStatus;
+
+    if (m_mediaPlaylistControl != nullptr) {
+        switch (m_mediaPlaylistControl->playbackMode())
+        {
+            case QMediaPlaylist::CurrentItemInLoop:
+                snapshot.loopStatus = media::Player::LoopStatus::LoopTrack;
+                break;
+            case QMediaPlaylist::Loop:
+                snapshot.loopStatus = media::Player::LoopStatus::LoopPlaylist;
+                break;
+            case QMediaPlaylist::Random:
+                snapshot.loopStatus = media::Player::LoopStatus::LoopPlaylist;
+                snapshot.shuffle = true;
+                break;
+            default:
+                break;
+        }
+    }
+    if (m_audioRoleControl != nullptr)
+        snapshot.audioRole = AalAudioRoleControl::fromQAudioRole(m_audioRoleControl->audioRole());
+    snapshot.volume = m_volume;
+    // The rate is never changed from here, media-hub's default is what the
+    // session had
+    return snapshot;
+}
+
+AalSessionSnapshot AalMediaPlayerService::captureClientState() const
+{
+    AalSessionSnapshot snapshot;
+    snapshot.uri = m_mediaUri;
+    snapshot.headers = m_mediaHeaders;
+    if (m_mediaPlaylistProvider != nullptr) {
+        const int count = m_mediaPlaylistProvider->mediaCount();
+        snapshot.tracks.reserve(count);
+        for (int i = 0; i < count; ++i)
+            snapshot.tracks.append(m_mediaPlaylistProvider->media(i).canonicalUrl());
     }
+    if (m_mediaPlaylistControl != nullptr)
+        snapshot.currentTrack = m_mediaPlaylistControl->currentIndex();
+    return snapshot;
+}
+
+bool AalMediaPlayerService::detachSession()
+{
+    if (m_hubPlayerSession == nullptr || m_sessionDetached)
+        return false;
+
+    qCDebug(aalPlayer) << Q_FUNC_INFO;
+    m_sessionSnapshot = captureSession();
+    releasePlayerSession();
+    return true;
+}
+
+void AalMediaPlayerService::releasePlayerSession()
+{
+    // The video sink goes away along with the session
+    if (m_videoOutput != nullptr)
+        m_videoOutput->enterBackground();
+
+    disconnectSignals();
+    // Controls share the session, it's only released once they all let go
+    if (m_audioRoleControl != nullptr)
+        m_audioRoleControl->setPlayerSession(nullptr);
+    if (m_mediaPlaylistControl != nullptr)
+        m_mediaPlaylistControl->setPlayerSession(nullptr);
+    destroyPlayerSession();
+
+    m_videoOutputReady = false;
+    m_sessionDetached = true;
+}
+
+bool AalMediaPlayerService::restoreSession()
+{
+    if (!m_sessionDetached)
+        return false;
+
+    QElapsedTimer resumeTimer;
+    resumeTimer.start();
+
+    if (!newMediaPlayer() || m_hubPlayerSession == nullptr) {
+        qCWarning(aalPlayer) << "Failed to restore the media-hub player session";
+        return false;
+    }
+    m_sessionDetached = false;
+
+    rebindPlayerSession();
+    applySessionSnapshot(m_sessionSnapshot);
+    m_sessionSnapshot = AalSessionSnapshot();
+    // Make sure the client's status (position, duration, state, etc) are all
+    // correct after restoring the media-hub Player session
+    updateClientSignals();
+
+    m_resumeLatency = resumeTimer.elapsed();
+    if (m_resumeLatency > ResumeLatencyTargetMs)
+        qCWarning(aalPlayer) << "Restoring the player session took" << m_resumeLatency
+                   << "ms, target is" << ResumeLatencyTargetMs << "ms";
+    else
+        qCDebug(aalPlayer) << "Restored the player session in" << m_resumeLatency << "ms";
+
+    return true;
+}
+
+void AalMediaPlayerService::rebindPlayerSession()
+{
+    connectSignals();
+
+    if (m_audioRoleControl != nullptr)
+        m_audioRoleControl->setPlayerSession(m_hubPlayerSession);
+    // Also gives the playlist provider a new, empty track list
+    if (m_mediaPlaylistControl != nullptr)
+        m_mediaPlaylistControl->setPlayerSession(m_hubPlayerSession);
+}
+
+void AalMediaPlayerService::applySessionSnapshot(const AalSessionSnapshot &snapshot)
+{
+    media::Player *player = m_hubPlayerSession.get();
+
+    {
+        AAL_BACKEND_CALL("Player::setAudioStreamRole");
+        player->setAudioStreamRole(snapshot.audioRole);
+    }
+    m_volume = snapshot.volume;
+    m_commandQueue->setVolume(m_volume);
+    m_commandQueue->setPlaybackRate(snapshot.playbackRate);
+    {
+        AAL_BACKEND_CALL("Player::setLoopStatus");
+        player->setLoopStatus(snapshot.loopStatus);
+    }
+    {
+        AAL_BACKEND_CALL("Player::setShuffle");
+        player->setShuffle(snapshot.shuffle);
+    }
+    // Unless the app changed it in the meantime
+    if (m_mediaPlaylistControl != nullptr)
+        m_mediaPlaylistControl->applyPendingPlaybackMode();
+
+    // The position belongs to the current track, so it can only be sought
+    // to once that track is loaded again
+    const quint64 position = snapshot.position;
+    const bool playing = snapshot.playbackStatus == media::Player::PlaybackStatus::Playing;
+    auto resume = [this, position, playing]() {
+        if (position > 0)
+            m_commandQueue->seekTo(position);
+        if (playing)
+            m_commandQueue->play();
+    };
+
+    if (!snapshot.tracks.isEmpty() && m_mediaPlaylistProvider != nullptr) {
+        m_mediaPlaylistProvider->restoreTracks(snapshot.tracks);
+        // Only once media-hub has reported the track back
+        const int index = qMax(0, snapshot.currentTrack);
+        m_mediaPlaylistProvider->whenAvailable(index, [this, index, resume]() {
+            if (m_hubPlayerSession == nullptr)
+                return;
+            if (index > 0) {
+                AAL_BACKEND_CALL("TrackList::goTo");
+                m_hubPlayerSession->trackList()->goTo(index);
+            }
+            resume();
+        });
+        return;
+    }
+
+    if (!snapshot.uri.isEmpty())
+        m_commandQueue->openUri(snapshot.uri, snapshot.headers);
+    resume();
 }
 
 void AalMediaPlayerService::onServiceDisconnected()
 {
-    qDebug() << Q_FUNC_INFO;
-    m_mediaPlayerControl->setState(QMediaPlayer::StoppedState);
-    m_mediaPlayerControl->setMediaStatus(QMediaPlayer::NoMedia);
+    qCDebug(aalPlayer) << Q_FUNC_INFO;
+    m_recoveryClock.start();
+
+    // What the client side of the session still knows is what gets replayed
+    // once media-hub is back. The session itself can't be asked anymore.
+    if (!m_sessionDetached)
+        m_sessionSnapshot = captureCachedSession();
+
+    m_mediaPlayerControl->setMediaStatus(QMediaPlayer::StalledMedia);
 }
 
 void AalMediaPlayerService::onServiceReconnected()
 {
-    qDebug() << Q_FUNC_INFO;
-    const QString errStr = "Player session is no longer valid since the service restarted.";
-    m_mediaPlayerControl->error(QMediaPlayer::ServiceMissingError, errStr);
+    qCDebug(aalPlayer) << Q_FUNC_INFO;
+    // The session didn't survive the restart. It is recreated from the next
+    // event loop pass, this is called from a signal of the session itself.
+    if (!m_recoveryClock.isValid())
+        m_recoveryClock.start();
+    m_recoveryAttempts = 0;
+    m_recoveryTimer.start(0);
+}
+
+void AalMediaPlayerService::recoverSession()
+{
+    if (!m_sessionDetached)
+        releasePlayerSession();
+
+    ++m_recoveryAttempts;
+    if (restoreSession()) {
+        // Video comes back with a new sink, unless nobody can see it anyway
+        if (qGuiApp == nullptr || qGuiApp->applicationState() == Qt::ApplicationActive)
+            leaveBackgroundMode();
+
+        m_recoveryTime = m_recoveryClock.elapsed();
+        m_recoveryClock.invalidate();
+        qCDebug(aalPlayer) << "Recovered the player session after a media-hub restart in"
+                 << m_recoveryTime << "ms (" << m_recoveryAttempts << "attempts )";
+        return;
+    }
+
+    if (m_recoveryAttempts >= RecoveryMaxAttempts) {
+        m_recoveryClock.invalidate();
+        const QString errStr = "Player session is no longer valid since the service restarted.";
+        m_mediaPlayerControl->setState(QMediaPlayer::StoppedState);
+        m_mediaPlayerControl->setMediaStatus(QMediaPlayer::NoMedia);
+        recordError(QMediaPlayer::ServiceMissingError);
+        m_mediaPlayerControl->error(QMediaPlayer::ServiceMissingError, errStr);
+        return;
+    }
+
+    const int retryMs = qMin(RecoveryFirstRetryMs << (m_recoveryAttempts - 1), RecoveryMaxRetryMs);
+    qCWarning(aalPlayer) << "Failed to recover the player session, retrying in" << retryMs << "ms";
+    m_recoveryTimer.start(retryMs);
 }
 
 void AalMediaPlayerService::onBufferingChanged()
 {
+    m_flightRecorder.record(AalFlightRecorder::Buffering, m_bufferPercent);
     Q_EMIT m_mediaPlayerControl->bufferStatusChanged(m_bufferPercent);
 }
 
+void AalMediaPlayerService::onPositionChanged(quint64 microseconds)
+{
+    const qint64 msec = microseconds / 1000;
+    updateCachedPosition(msec);
+
+    // Only pass on as much as is needed to keep a progress bar moving
+    if (m_notifiedPosition < 0 || qAbs(msec - m_notifiedPosition) >= m_positionGranularity)
+        notifyPosition(msec);
+}
+
+void AalMediaPlayerService::onSeekedTo(quint64 microseconds)
+{
+    const qint64 msec = microseconds / 1000;
+    m_pendingSeek = -1;
+    updateCachedPosition(msec);
+    notifyPosition(msec);
+}
+
+void AalMediaPlayerService::updateCachedPosition(qint64 msec) const
+{
+    m_cachedPosition = msec;
+    m_positionClock.start();
+}
+
+void AalMediaPlayerService::invalidateCachedPosition()
+{
+    m_cachedPosition = -1;
+    m_notifiedPosition = -1;
+    m_pendingSeek = -1;
+}
+
+void AalMediaPlayerService::notifyPosition(qint64 msec)
+{
+    m_notifiedPosition = msec;
+    if (m_mediaPlayerControl != nullptr)
+        Q_EMIT m_mediaPlayerControl->positionChanged(msec);
+}
+
 void AalMediaPlayerService::updateClientSignals()
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlayer) << Q_FUNC_INFO;
     if (m_mediaPlayerControl == nullptr)
         return;
 
@@ -658,12 +1095,45 @@ void AalMediaPlayerService::updateClientSignals()
             m_mediaPlayerControl->setState(QMediaPlayer::PlayingState);
             break;
         default:
-            qWarning() << "Unknown PlaybackStatus: " << m_newStatus;
+            qCWarning(aalPlayer) << "Unknown PlaybackStatus: " << m_newStatus;
     }
 }
 
 void AalMediaPlayerService::connectSignals()
 {
+    if (m_commandQueue->isThreaded()) {
+        // The worker reads the new state, onStateRefreshed() takes it from
+        // there
+        const auto refreshState = [this]() { m_commandQueue->refreshState(); };
+        QObject::connect(m_hubPlayerSession.get(), &media::Player::playbackStatusChanged,
+                         this, refreshState);
+        QObject::connect(m_hubPlayerSession.get(), &media::Player::durationChanged,
+                         this, refreshState);
+        QObject::connect(m_hubPlayerSession.get(), &media::Player::sourceTypeChanged,
+                         this, refreshState);
+        QObject::connect(m_hubPlayerSession.get(), &media::Player::volumeChanged,
+                         this, refreshState);
+    } else {
+        QObject::connect(m_hubPlayerSession.get(), &media::Player::playbackStatusChanged,
+                         this, &AalMediaPlayerService::onPlaybackStatusChanged);
+    }
+
+    QObject::connect(m_hubPlayerSession.get(), &media::Player::bufferingChanged, this,
+                [this](int bufferingPercent) {
+                    m_bufferPercent = bufferingPercent;
+                    onBufferingChanged();
+                });
+
+    QObject::connect(m_hubPlayerSession.get(), &media::Player::errorOccurred,
+                     this, &AalMediaPlayerService::onError);
+
+    // A new session knows nothing about the position of the previous one
+    invalidateCachedPosition();
+    QObject::connect(m_hubPlayerSession.get(), &media::Player::positionChanged,
+                     this, &AalMediaPlayerService::onPositionChanged);
+    QObject::connect(m_hubPlayerSession.get(), &media::Player::seekedTo,
+                     this, &AalMediaPlayerService::onSeekedTo);
+
     QObject::connect(m_hubPlayerSession.get(), &media::Player::endOfStream,
                      this, [this]()
         {
@@ -672,7 +1142,7 @@ void AalMediaPlayerService::connectSignals()
         });
 
     QObject::connect(m_hubPlayerSession.get(), &media::Player::serviceDisconnected,
-                     this, &AalMediaPlayerService::onServiceReconnected);
+                     this, &AalMediaPlayerService::onServiceDisconnected);
     QObject::connect(m_hubPlayerSession.get(), &media::Player::serviceReconnected,
                      this, &AalMediaPlayerService::onServiceReconnected);
 }
@@ -682,12 +1152,62 @@ void AalMediaPlayerService::disconnectSignals()
     QObject::disconnect(m_hubPlayerSession.get(), nullptr, this, nullptr);
 }
 
+AalBackendLock *AalMediaPlayerService::backendLock() const
+{
+    return m_commandQueue->backendLock();
+}
+
+media::Player::PlaybackStatus AalMediaPlayerService::hubPlaybackStatus() const
+{
+    if (m_commandQueue->isThreaded())
+        return m_commandQueue->state().playbackStatus;
+
+    AAL_BACKEND_CALL("Player::playbackStatus");
+    return m_hubPlayerSession->playbackStatus();
+}
+
+void AalMediaPlayerService::onStateRefreshed()
+{
+    if (m_hubPlayerSession == nullptr)
+        return;
+
+    const AalPlayerState state = m_commandQueue->state();
+    if (!state.valid)
+        return;
+
+    // A volume still queued is newer than the one read back
+    if (m_commandQueue->pendingCommands() == 0)
+        m_volume = state.volume;
+    if (state.playbackStatus != m_newStatus)
+        onPlaybackStatusChanged();
+    // Passes on a duration that changed
+    if (m_mediaPlayerControl != nullptr)
+        duration();
+}
+
 void AalMediaPlayerService::onError(const media::Error &error)
 {
-    qWarning() << "** Media playback error: " << error.message();
+    qCWarning(aalPlayer) << "** Media playback error: " << error.message();
     signalQMediaPlayerError(error);
 }
 
+void AalMediaPlayerService::recordError(QMediaPlayer::Error error)
+{
+    m_flightRecorder.record(AalFlightRecorder::Error, error);
+    if (m_flightRecorderDir.isEmpty())
+        return;
+
+    const QString fileName = QString("qtubuntu-media-%1-%2.aalrec")
+            .arg(QCoreApplication::applicationPid())
+            .arg(QDateTime::currentMSecsSinceEpoch());
+    dumpFlightRecorder(QDir(m_flightRecorderDir).filePath(fileName));
+}
+
+bool AalMediaPlayerService::dumpFlightRecorder(const QString &fileName) const
+{
+    return m_flightRecorder.dump(fileName);
+}
+
 QString AalMediaPlayerService::playbackStatusStr(const media::Player::PlaybackStatus &status)
 {
     switch (status)
@@ -701,7 +1221,7 @@ QString AalMediaPlayerService::playbackStatusStr(const media::Player::PlaybackSt
         case media::Player::PlaybackStatus::Playing:
             return "playing";
         default:
-            qWarning() << "Unknown PlaybackStatus: " << status;
+            qCWarning(aalPlayer) << "Unknown PlaybackStatus: " << status;
             return QString();
     }
 }
@@ -712,9 +1232,6 @@ void AalMediaPlayerService::setPlayer(const std::shared_ptr<media::Player> &play
 
     createMediaPlayerControl();
     createVideoRendererControl();
-
-    QObject::connect(m_hubPlayerSession.get(), &media::Player::playbackStatusChanged,
-                     this, &AalMediaPlayerService::onPlaybackStatusChanged);
 }
 
 #ifdef MEASURE_PERFORMANCE
@@ -726,14 +1243,14 @@ void AalMediaPlayerService::measurePerformance()
         m_lastFrameDecodeStart = QDateTime::currentMSecsSinceEpoch();
         if (delta > 0) {
             m_frameDecodeAvg += delta;
-            qDebug() << "Frame-to-frame decode delta (ms): " << delta;
+            qCDebug(aalPlayer) << "Frame-to-frame decode delta (ms): " << delta;
         }
     }
 
     if (m_avgCount == 30) {
         // Ideally if playing a video that was recorded at 30 fps, the average for
         // playback should be close to 30 fps too
-        qDebug() << "Frame-to-frame decode average (ms) (30 frames times counted): " << (m_frameDecodeAvg / 30);
+        qCDebug(aalPlayer) << "Frame-to-frame decode average (ms) (30 frames times counted): " << (m_frameDecodeAvg / 30);
         m_avgCount = m_frameDecodeAvg = 0;
     }
     else
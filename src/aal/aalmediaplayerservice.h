@@ -17,13 +17,18 @@
 #ifndef AALMEDIAPLAYERSERVICE_H
 #define AALMEDIAPLAYERSERVICE_H
 
+#include "aalflightrecorder.h"
 #include "aalvideorenderercontrol.h"
 
 #include <MediaHub/Player>
 
 #include <qmediaplayer.h>
 #include <QMediaPlaylist>
+#include <QElapsedTimer>
 #include <QMediaService>
+#include <QTimer>
+#include <QUrl>
+#include <QVector>
 
 #include <memory>
 
@@ -33,6 +38,8 @@ class AalMediaPlaylistProvider;
 class QMediaPlayerControl;
 class AalVideoRendererControl;
 class AalAudioRoleControl;
+class AalBackendLock;
+class AalPlayerCommandQueue;
 class tst_MediaPlayerPlugin;
 class QTimerEvent;
 
@@ -42,6 +49,24 @@ class TrackList;
 class VideoSink;
 } }
 
+// Everything needed to bring a released media-hub player session back the
+// way it was
+struct AalSessionSnapshot
+{
+    QUrl uri;
+    lomiri::MediaHub::Player::Headers headers;
+    QVector<QUrl> tracks;
+    int currentTrack = -1;
+    // Microseconds
+    quint64 position = 0;
+    lomiri::MediaHub::Player::PlaybackStatus playbackStatus = lomiri::MediaHub::Player::PlaybackStatus::Null;
+    lomiri::MediaHub::Player::LoopStatus loopStatus = lomiri::MediaHub::Player::LoopStatus::LoopNone;
+    bool shuffle = false;
+    lomiri::MediaHub::Player::AudioStreamRole audioRole = lomiri::MediaHub::Player::AudioStreamRole::MultimediaRole;
+    lomiri::MediaHub::Player::Volume volume = 1.0;
+    lomiri::MediaHub::Player::PlaybackRate playbackRate = 1.0;
+};
+
 class AalMediaPlayerService : public QMediaService
 {
     Q_OBJECT
@@ -65,6 +90,10 @@ public:
     bool newMediaPlayer();
 
     lomiri::MediaHub::VideoSink &createVideoSink(uint32_t texture_id);
+    // Whether the player's sinks can write frames to CPU memory, see
+    // AalMappableFrameSource. media-hub's own sinks can't; a backend whose
+    // sinks can says so with the "mappableVideoSinks" property of its Player.
+    bool canMapVideoFrames() const;
     // Call this before attempting to play the same video a second time (after EOS)
     void resetVideoSink();
 
@@ -76,12 +105,15 @@ public:
     void play();
     void pause();
     void stop();
+    // Mostly answered from the positions media-hub pushes, see
+    // onPositionChanged()
     int64_t position() const;
     void setPosition(int64_t msec);
     int64_t duration();
     bool isVideoSource() const;
     bool isAudioSource() const;
 
+    // 0 to 100, like QMediaPlayer
     int getVolume() const;
     void setVolume(int volume);
 
@@ -95,6 +127,32 @@ public:
 
     int bufferStatus() { return m_bufferPercent; }
 
+    // How far in ms the position has to move on before a position pushed by
+    // media-hub is passed on as positionChanged(). Seeks are always passed
+    // on. Defaults to QTUBUNTU_MEDIA_POSITION_GRANULARITY_MS or 1000.
+    int positionGranularity() const { return m_positionGranularity; }
+    void setPositionGranularity(int msec) { m_positionGranularity = qMax(0, msec); }
+
+    // Releases the media-hub player session, keeping a snapshot of its state
+    // that restoreSession() sets a new session up from in one go. Done when
+    // the application gets suspended while not playing, if
+    // QTUBUNTU_MEDIA_DETACH_ON_SUSPEND=1.
+    bool detachSession();
+    bool restoreSession();
+    bool isSessionDetached() const { return m_sessionDetached; }
+    AalSessionSnapshot captureSession() const;
+    // Like captureSession() but only from what is known without asking
+    // media-hub, for when the session is gone
+    AalSessionSnapshot captureCachedSession() const;
+    // How long the last restoreSession() took in ms, -1 if there was none
+    qint64 lastResumeLatency() const { return m_resumeLatency; }
+    // Time from media-hub going away to the session being usable again after
+    // the last restart of media-hub in ms, -1 if there was none
+    qint64 lastRecoveryTime() const { return m_recoveryTime; }
+
+    AalFlightRecorder &flightRecorder() { return m_flightRecorder; }
+    bool dumpFlightRecorder(const QString &fileName) const;
+
 Q_SIGNALS:
     void serviceReady();
     void playbackComplete();
@@ -106,6 +164,8 @@ public Q_SLOTS:
     void onServiceDisconnected();
     void onServiceReconnected();
     void onBufferingChanged();
+    void onPositionChanged(quint64 microseconds);
+    void onSeekedTo(quint64 microseconds);
 
 protected:
     void constructNewPlayerService();
@@ -128,13 +188,43 @@ private:
     void deletePlaylistControl();
     void deleteAudioRoleControl();
 
+    // Suspends video delivery while the application is hidden or suspended
+    void enterBackgroundMode();
+    void leaveBackgroundMode();
+
+    // Drops the session and everything in the controls tied to it
+    void releasePlayerSession();
+    // Hands the current player session to every control
+    void rebindPlayerSession();
+    // Recreates the session after media-hub restarted
+    void recoverSession();
+    void applySessionSnapshot(const AalSessionSnapshot &snapshot);
+    // The parts of a snapshot that are kept on this side
+    AalSessionSnapshot captureClientState() const;
+
+    // Guards calls into m_hubPlayerSession, see AalPlayerCommandQueue
+    AalBackendLock *backendLock() const;
+    // With a threaded command queue, what its worker last read. Otherwise
+    // media-hub is asked.
+    lomiri::MediaHub::Player::PlaybackStatus hubPlaybackStatus() const;
+    void onStateRefreshed();
+
     // Signals the proper QMediaPlayer::Error from a lomiri::MediaHub
     void signalQMediaPlayerError(const lomiri::MediaHub::Error &error);
     void onError(const lomiri::MediaHub::Error &error);
+    void recordError(QMediaPlayer::Error error);
+
+    void updateCachedPosition(qint64 msec) const;
+    void invalidateCachedPosition();
+    void notifyPosition(qint64 msec);
 
     inline QString playbackStatusStr(const lomiri::MediaHub::Player::PlaybackStatus &status);
 
     std::shared_ptr<lomiri::MediaHub::Player> m_hubPlayerSession;
+    // Playback commands for m_hubPlayerSession, sent from a worker thread
+    // when QTUBUNTU_MEDIA_IPC_THREAD=1. Getters are then answered from the
+    // state the worker reads back.
+    AalPlayerCommandQueue *m_commandQueue;
 
     AalMediaPlayerControl *m_mediaPlayerControl;
     AalVideoRendererControl *m_videoOutput;
@@ -145,14 +235,40 @@ private:
     bool m_firstPlayback;
 
     uint64_t m_cachedDuration;
+    // Last volume set or read back by the command queue's worker,
+    // media-hub's default until then
+    lomiri::MediaHub::Player::Volume m_volume;
 
     const QMediaPlaylist* m_mediaPlaylist;
 
     lomiri::MediaHub::Player::PlaybackStatus m_newStatus;
     int m_bufferPercent;
 
+    // Last position media-hub told about and when, -1 if unknown
+    mutable qint64 m_cachedPosition;
+    mutable QElapsedTimer m_positionClock;
+    int m_positionGranularity;
+    // Last position passed on with positionChanged()
+    qint64 m_notifiedPosition;
+    // Last seek sent that media-hub hasn't confirmed yet, -1 if none
+    qint64 m_pendingSeek;
+
     QString m_sessionUuid;
-    bool m_doReattachSession;
+    QUrl m_mediaUri;
+    lomiri::MediaHub::Player::Headers m_mediaHeaders;
+    bool m_detachOnSuspend;
+    bool m_sessionDetached;
+    AalSessionSnapshot m_sessionSnapshot;
+    qint64 m_resumeLatency;
+    QTimer m_recoveryTimer;
+    QElapsedTimer m_recoveryClock;
+    int m_recoveryAttempts;
+    qint64 m_recoveryTime;
+
+    AalFlightRecorder m_flightRecorder;
+    // Where the flight recorder gets dumped to on errors, from
+    // QTUBUNTU_MEDIA_FLIGHT_RECORDER_DIR. No dumps if empty.
+    QString m_flightRecorderDir;
 
 #ifdef MEASURE_PERFORMANCE
     qint64 m_lastFrameDecodeStart;
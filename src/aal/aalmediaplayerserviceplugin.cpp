@@ -15,6 +15,7 @@
  */
 
 #include "aalmediaplayerserviceplugin.h"
+#include "aallogging.h"
 #include "aalmediaplayerservice.h"
 
 #include <QDebug>
@@ -25,7 +26,7 @@ AalServicePlugin::AalServicePlugin()
 
 QMediaService* AalServicePlugin::create(QString const& key)
 {
-    qDebug() << Q_FUNC_INFO << key;
+    qCDebug(aalPlayer) << Q_FUNC_INFO << key;
 
     if (key == QLatin1String(Q_MEDIASERVICE_MEDIAPLAYER))
         return new AalMediaPlayerService();
@@ -14,8 +14,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "aalbackendwatchdog.h"
 #include "aalmediaplaylistcontrol.h"
+#include "aallogging.h"
 #include "aalmediaplaylistprovider.h"
+#include "aaltracer.h"
 
 #include <QEventLoop>
 #include <QMediaPlaylist>
@@ -27,13 +30,30 @@
 
 namespace media = lomiri::MediaHub;
 
+namespace
+{
+// Skips closer together than this are sent to media-hub as one goTo()
+const int SkipCoalesceMs = 100;
+}
+
 QT_BEGIN_NAMESPACE
 
 AalMediaPlaylistControl::AalMediaPlaylistControl(QObject *parent)
     : QMediaPlaylistControl(parent),
+      m_hubTrackList(nullptr),
       m_playlistProvider(nullptr),
-      m_currentIndex(0)
+      m_currentIndex(0),
+      m_currentIndexRefreshPending(false),
+      m_pendingSkip(-1),
+      m_sentSkip(-1),
+      m_playbackMode(QMediaPlaylist::Sequential),
+      m_playbackModePending(false),
+      m_settingPlaybackMode(false),
+      m_backendLock(nullptr)
 {
+    m_skipTimer.setSingleShot(true);
+    m_skipTimer.setInterval(SkipCoalesceMs);
+    connect(&m_skipTimer, &QTimer::timeout, this, &AalMediaPlaylistControl::commitSkip);
 }
 
 AalMediaPlaylistControl::~AalMediaPlaylistControl()
@@ -48,7 +68,9 @@ QMediaPlaylistProvider* AalMediaPlaylistControl::playlistProvider() const
 bool AalMediaPlaylistControl::setPlaylistProvider(QMediaPlaylistProvider *playlist)
 {
     m_playlistProvider = playlist;
-    connect(playlist, SIGNAL(currentIndexChanged()), this, SLOT(onCurrentIndexChanged()));
+    connect(playlist, SIGNAL(currentIndexChanged(int)), this, SLOT(onCurrentIndexChanged(int)));
+    if (AalMediaPlaylistProvider *provider = qobject_cast<AalMediaPlaylistProvider*>(playlist))
+        connect(provider, &AalMediaPlaylistProvider::loadProgress, this, &AalMediaPlaylistControl::loadProgress);
     Q_EMIT playlistProviderChanged();
     return true;
 }
@@ -60,16 +82,31 @@ int AalMediaPlaylistControl::currentIndex() const
 
 void AalMediaPlaylistControl::setCurrentIndex(int position)
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlaylist) << Q_FUNC_INFO;
     const auto mediaCount = m_playlistProvider->mediaCount();
-    qDebug() << "position: " << position << ", mediaCount: " << mediaCount;
+    qCDebug(aalPlaylist) << "position: " << position << ", mediaCount: " << mediaCount;
 
     if (position < 0 || position >= mediaCount)
         return;
 
-    qDebug() << "Going to position: " << position;
+    qCDebug(aalPlaylist) << "Going to position: " << position;
+
+    // Supersedes any skip still on its way
+    m_skipTimer.stop();
+    m_pendingSkip = -1;
+    m_sentSkip = -1;
 
-    m_hubTrackList->goTo(position);
+    if (!m_hubTrackList) {
+        qCWarning(aalPlaylist) << "Can't go to track" << position << "without a player session";
+        return;
+    }
+
+    // The track may still be on its way to media-hub, see
+    // AalMediaPlaylistProvider::addMedia()
+    aalMediaPlaylistProvider()->whenAvailable(position, [this, position]() {
+        AAL_BACKEND_CALL("TrackList::goTo");
+        m_hubTrackList->goTo(position);
+    });
 }
 
 int AalMediaPlaylistControl::nextIndex(int steps) const
@@ -77,10 +114,10 @@ int AalMediaPlaylistControl::nextIndex(int steps) const
     const int x = m_currentIndex + steps;
     const int tracklistSize = m_playlistProvider->mediaCount();
 #ifdef VERBOSE_DEBUG
-    qDebug() << "m_currentIndex: " << m_currentIndex;
-    qDebug() << "steps: " << steps;
-    qDebug() << "tracklistSize: " << tracklistSize;
-    qDebug() << "------------------------";
+    qCDebug(aalPlaylist) << "m_currentIndex: " << m_currentIndex;
+    qCDebug(aalPlaylist) << "steps: " << steps;
+    qCDebug(aalPlaylist) << "tracklistSize: " << tracklistSize;
+    qCDebug(aalPlaylist) << "------------------------";
 #endif
     if (x < tracklistSize)
         return x;
@@ -98,12 +135,12 @@ int AalMediaPlaylistControl::previousIndex(int steps) const
     // to only wrap around the list one time
 #ifdef VERBOSE_DEBUG
     const uint16_t m = (uint16_t)std::abs(x) / (uint16_t)tracklistSize; // 3
-    qDebug() << "m_currentIndex: " << m_currentIndex;
-    qDebug() << "steps: " << steps;
-    qDebug() << "tracklistSize: " << tracklistSize;
-    qDebug() << "x: " << x;
-    qDebug() << "m: " << m;
-    qDebug() << "------------------------";
+    qCDebug(aalPlaylist) << "m_currentIndex: " << m_currentIndex;
+    qCDebug(aalPlaylist) << "steps: " << steps;
+    qCDebug(aalPlaylist) << "tracklistSize: " << tracklistSize;
+    qCDebug(aalPlaylist) << "x: " << x;
+    qCDebug(aalPlaylist) << "m: " << m;
+    qCDebug(aalPlaylist) << "------------------------";
 #endif
     if (x >= 0)
         return x;
@@ -131,23 +168,126 @@ int AalMediaPlaylistControl::previousIndex(int steps) const
 
 void AalMediaPlaylistControl::next()
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlaylist) << Q_FUNC_INFO;
+
+    const int index = nextIndex(1);
+    if (canSkipTo(index, index <= m_currentIndex))
+    {
+        skipTo(index);
+        return;
+    }
+
+    if (!m_hubPlayerSession) {
+        qCWarning(aalPlaylist) << "Can't go to the next track without a player session";
+        return;
+    }
 
+    // media-hub has to know where the last skip went before it moves on
+    commitSkip();
+    AAL_BACKEND_CALL("Player::goToNext");
     m_hubPlayerSession->goToNext();
 }
 
 void AalMediaPlaylistControl::previous()
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlaylist) << Q_FUNC_INFO;
 
+    const int index = previousIndex(1);
+    if (canSkipTo(index, index >= m_currentIndex))
+    {
+        skipTo(index);
+        return;
+    }
+
+    if (!m_hubPlayerSession) {
+        qCWarning(aalPlaylist) << "Can't go to the previous track without a player session";
+        return;
+    }
+
+    commitSkip();
+    AAL_BACKEND_CALL("Player::goToPrevious");
     m_hubPlayerSession->goToPrevious();
 }
 
+bool AalMediaPlaylistControl::canSkipTo(int index, bool wraps) const
+{
+    if (index < 0 || index >= m_playlistProvider->mediaCount())
+        return false;
+
+    // In the other modes media-hub picks the track: randomly, or by its own
+    // rules for a looped track
+    switch (playbackMode())
+    {
+        case QMediaPlaylist::Sequential:
+            return !wraps;
+        case QMediaPlaylist::Loop:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void AalMediaPlaylistControl::skipTo(int index)
+{
+    qCDebug(aalPlaylist) << "Skipping to" << index;
+
+    m_currentIndex = index;
+    m_pendingSkip = index;
+    // The first skip of a burst goes out right away, the others once the
+    // burst is over
+    if (!m_skipTimer.isActive())
+        commitSkip();
+    m_skipTimer.start();
+
+    AAL_TRACE_INSTANT_ARG("skip", "playlist", "index", m_currentIndex);
+    Q_EMIT currentMediaChanged(m_playlistProvider->media(m_currentIndex));
+    Q_EMIT currentIndexChanged(m_currentIndex);
+}
+
+void AalMediaPlaylistControl::commitSkip()
+{
+    m_skipTimer.stop();
+    if (m_pendingSkip < 0)
+        return;
+
+    const int index = m_pendingSkip;
+    m_pendingSkip = -1;
+
+    // The playlist may have been edited since the skip
+    if (!m_hubTrackList || index >= m_playlistProvider->mediaCount())
+    {
+        qCWarning(aalPlaylist) << "Dropping skip to track" << index << "which is gone";
+        return;
+    }
+
+    // The track may still be on its way to media-hub, see
+    // AalMediaPlaylistProvider::addMedia()
+    m_sentSkip = index;
+    aalMediaPlaylistProvider()->whenAvailable(index, [this, index]() {
+        AAL_BACKEND_CALL("TrackList::goTo");
+        m_hubTrackList->goTo(index);
+    });
+}
+
 QMediaPlaylist::PlaybackMode AalMediaPlaylistControl::playbackMode() const
 {
+    // Kept up to date by refreshPlaybackMode(), or the one to set once there
+    // is a session again
+    return m_playbackMode;
+}
+
+void AalMediaPlaylistControl::refreshPlaybackMode()
+{
+    // The change being sent is what counts, see setPlaybackMode()
+    if (!m_hubPlayerSession || m_playbackModePending || m_settingPlaybackMode)
+        return;
+
     QMediaPlaylist::PlaybackMode currentMode = QMediaPlaylist::Sequential;
     media::Player::LoopStatus loopStatus = media::Player::LoopStatus::LoopNone;
-    loopStatus = m_hubPlayerSession->loopStatus();
+    {
+        AAL_BACKEND_CALL("Player::loopStatus");
+        loopStatus = m_hubPlayerSession->loopStatus();
+    }
     switch (loopStatus)
     {
         case media::Player::LoopStatus::LoopNone:
@@ -160,74 +300,160 @@ QMediaPlaylist::PlaybackMode AalMediaPlaylistControl::playbackMode() const
             currentMode = QMediaPlaylist::Loop;
             break;
         default:
-            qWarning() << "Unknown loop status: " << loopStatus;
+            qCWarning(aalPlaylist) << "Unknown loop status: " << loopStatus;
     }
 
     // Shuffle overrides loopStatus since in the media-hub API random is not part of loop_status
     // like it's all one for QMediaPlaylist::PlaybackMode
-    if (m_hubPlayerSession->shuffle())
+    bool shuffle = false;
+    {
+        AAL_BACKEND_CALL("Player::shuffle");
+        shuffle = m_hubPlayerSession->shuffle();
+    }
+    if (shuffle)
         currentMode = QMediaPlaylist::Random;
 
-    return currentMode;
+    if (currentMode == m_playbackMode)
+        return;
+
+    qCDebug(aalPlaylist) << "Playback mode changed to" << currentMode;
+    m_playbackMode = currentMode;
+    Q_EMIT playbackModeChanged(currentMode);
 }
 
 void AalMediaPlaylistControl::setPlaybackMode(QMediaPlaylist::PlaybackMode mode)
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlaylist) << Q_FUNC_INFO;
+    m_playbackMode = mode;
+
+    // Applied by applyPendingPlaybackMode() once the session is back
+    if (!m_hubPlayerSession) {
+        qCDebug(aalPlaylist) << "No player session, keeping playback mode" << mode << "for later";
+        m_playbackModePending = true;
+        Q_EMIT playbackModeChanged(mode);
+        return;
+    }
+    m_playbackModePending = false;
+
+    bool shuffle = false;
+    // Left alone if there is no media-hub equivalent
+    bool setLoopStatus = true;
+    media::Player::LoopStatus loopStatus = media::Player::LoopStatus::LoopNone;
     switch (mode)
     {
         case QMediaPlaylist::CurrentItemOnce:
-            qDebug() << "PlaybackMode: CurrentItemOnce";
-            m_hubPlayerSession->setShuffle(false);
-            qWarning() << "No media-hub equivalent for QMediaPlaylist::CurrentItemOnce";
+            qCDebug(aalPlaylist) << "PlaybackMode: CurrentItemOnce";
+            qCWarning(aalPlaylist) << "No media-hub equivalent for QMediaPlaylist::CurrentItemOnce";
+            setLoopStatus = false;
             break;
         case QMediaPlaylist::CurrentItemInLoop:
-            qDebug() << "PlaybackMode: CurrentItemInLoop";
-            m_hubPlayerSession->setShuffle(false);
-            m_hubPlayerSession->setLoopStatus(media::Player::LoopStatus::LoopTrack);
+            qCDebug(aalPlaylist) << "PlaybackMode: CurrentItemInLoop";
+            loopStatus = media::Player::LoopStatus::LoopTrack;
             break;
         case QMediaPlaylist::Sequential:
-            qDebug() << "PlaybackMode: Sequential";
-            m_hubPlayerSession->setShuffle(false);
-            m_hubPlayerSession->setLoopStatus(media::Player::LoopStatus::LoopNone);
+            qCDebug(aalPlaylist) << "PlaybackMode: Sequential";
+            loopStatus = media::Player::LoopStatus::LoopNone;
             break;
         case QMediaPlaylist::Loop:
-            qDebug() << "PlaybackMode: Loop";
-            m_hubPlayerSession->setShuffle(false);
-            m_hubPlayerSession->setLoopStatus(media::Player::LoopStatus::LoopPlaylist);
+            qCDebug(aalPlaylist) << "PlaybackMode: Loop";
+            loopStatus = media::Player::LoopStatus::LoopPlaylist;
             break;
         case QMediaPlaylist::Random:
-            qDebug() << "PlaybackMode: Random";
-            m_hubPlayerSession->setShuffle(true);
+            qCDebug(aalPlaylist) << "PlaybackMode: Random";
+            shuffle = true;
                 // FIXME: Until pad.lv/1518157 (RandomAndLoop playbackMode) is
                 // fixed set Random to be always looping due to pad.lv/1531296
-            m_hubPlayerSession->setLoopStatus(media::Player::LoopStatus::LoopPlaylist);
+            loopStatus = media::Player::LoopStatus::LoopPlaylist;
             break;
         default:
-            qWarning() << "Unknown playback mode: " << mode;
-            m_hubPlayerSession->setShuffle(false);
+            qCWarning(aalPlaylist) << "Unknown playback mode: " << mode;
+            setLoopStatus = false;
+    }
+
+    // The change signals in between would report a mix of old and new
+    m_settingPlaybackMode = true;
+    {
+        AAL_BACKEND_CALL("Player::setShuffle");
+        m_hubPlayerSession->setShuffle(shuffle);
+    }
+    if (setLoopStatus) {
+        AAL_BACKEND_CALL("Player::setLoopStatus");
+        m_hubPlayerSession->setLoopStatus(loopStatus);
     }
+    m_settingPlaybackMode = false;
 
     Q_EMIT playbackModeChanged(mode);
 }
 
+void AalMediaPlaylistControl::applyPendingPlaybackMode()
+{
+    if (m_playbackModePending && m_hubPlayerSession)
+        setPlaybackMode(m_playbackMode);
+}
+
 void AalMediaPlaylistControl::setPlayerSession(const std::shared_ptr<lomiri::MediaHub::Player>& playerSession)
 {
+    if (m_hubPlayerSession)
+        QObject::disconnect(m_hubPlayerSession.get(), nullptr, this, nullptr);
     m_hubPlayerSession = playerSession;
     aalMediaPlaylistProvider()->setPlayerSession(playerSession);
 
-    m_hubTrackList = m_hubPlayerSession->trackList();
+    // The session is being released, see AalMediaPlayerService::detachSession()
+    if (!m_hubPlayerSession) {
+        m_skipTimer.stop();
+        m_pendingSkip = -1;
+        m_sentSkip = -1;
+        m_hubTrackList = nullptr;
+        return;
+    }
+
+    {
+        AAL_BACKEND_CALL("Player::trackList");
+        m_hubTrackList = m_hubPlayerSession->trackList();
+    }
     if (!m_hubTrackList) {
-        qWarning() << "FATAL: Failed to retrieve the current player session TrackList";
+        qCWarning(aalPlaylist) << "FATAL: Failed to retrieve the current player session TrackList";
     }
 
+    // canSkipTo() needs the mode for every skip, asking media-hub for it
+    // each time would cost two round trips
+    QObject::connect(m_hubPlayerSession.get(), &media::Player::loopStatusChanged,
+                     this, &AalMediaPlaylistControl::refreshPlaybackMode);
+    QObject::connect(m_hubPlayerSession.get(), &media::Player::shuffleChanged,
+                     this, &AalMediaPlaylistControl::refreshPlaybackMode);
+    refreshPlaybackMode();
+
     connect_signals();
 }
 
 void AalMediaPlaylistControl::onTrackChanged()
 {
-    m_currentIndex = m_hubTrackList->currentTrack();
-    qDebug() << "m_currentIndex updated to: " << m_currentIndex;
+    // The goTo() that is about to be sent overrides this, so don't spend an
+    // IPC on asking where media-hub went
+    if (m_pendingSkip >= 0)
+    {
+        qCDebug(aalPlaylist) << "Ignoring track change while skipping to" << m_pendingSkip;
+        return;
+    }
+
+    int index;
+    {
+        AAL_BACKEND_CALL("TrackList::currentTrack");
+        index = m_hubTrackList->currentTrack();
+    }
+
+    // Skips are shown when they are made, only tell about media-hub going
+    // somewhere else
+    if (m_sentSkip >= 0)
+    {
+        m_sentSkip = -1;
+        if (index == m_currentIndex)
+            return;
+    }
+
+    m_currentIndex = index;
+    qCDebug(aalPlaylist) << "m_currentIndex updated to: " << m_currentIndex;
+    AAL_TRACE_INSTANT_ARG("trackChanged", "playlist", "index", m_currentIndex);
     const QMediaContent content = playlistProvider()->media(m_currentIndex);
     Q_EMIT currentMediaChanged(content);
     Q_EMIT currentIndexChanged(m_currentIndex);
@@ -244,7 +470,7 @@ void AalMediaPlaylistControl::onMediaRemoved(int start, int end)
     // selected instead of the desired track index
     if (aalMediaPlaylistProvider()->mediaCount() == 0)
     {
-        qDebug() << "Tracklist was cleared, resetting m_currentIndex to 0";
+        qCDebug(aalPlaylist) << "Tracklist was cleared, resetting m_currentIndex to 0";
         m_currentIndex = 0;
     }
 }
@@ -263,23 +489,70 @@ void AalMediaPlaylistControl::onRemoveTracks(int start, int end)
         setCurrentIndex(0);
 
         // When repeat is off we have reached the end of playback so stop
-        if (playbackMode() == QMediaPlaylist::Sequential)
+        if (m_hubPlayerSession && playbackMode() == QMediaPlaylist::Sequential)
         {
-            qDebug() << "Repeat is off, so stopping playback";
+            qCDebug(aalPlaylist) << "Repeat is off, so stopping playback";
             try {
+                AAL_BACKEND_CALL("Player::stop");
                 m_hubPlayerSession->stop();
             } catch (std::runtime_error &e) {
-                qWarning() << "FATAL: Failed to stop playback:" << e.what();
+                qCWarning(aalPlaylist) << "FATAL: Failed to stop playback:" << e.what();
             }
         }
     }
 }
 
-void AalMediaPlaylistControl::onCurrentIndexChanged()
+void AalMediaPlaylistControl::onMediaMoved(int from, int to)
+{
+    // media-hub keeps the same track current, which is enough to know its
+    // new index without asking
+    int index = m_currentIndex;
+    if (index == from)
+        index = to;
+    else if (from < index && index <= to)
+        --index;
+    else if (to <= index && index < from)
+        ++index;
+
+    if (index == m_currentIndex)
+        return;
+
+    qCDebug(aalPlaylist) << "Current track moved to" << index;
+    m_currentIndex = index;
+    Q_EMIT currentIndexChanged(m_currentIndex);
+}
+
+void AalMediaPlaylistControl::onCurrentIndexChanged(int first)
+{
+    // Tracks added, removed or moved after the current one can't change its index
+    if (first > m_currentIndex)
+        return;
+
+    // Bulk edits emit this once per track, so only ask media-hub for the
+    // current track once all of them have been processed
+    if (m_currentIndexRefreshPending)
+        return;
+
+    m_currentIndexRefreshPending = true;
+    QMetaObject::invokeMethod(this, "refreshCurrentIndex", Qt::QueuedConnection);
+}
+
+void AalMediaPlaylistControl::refreshCurrentIndex()
 {
-    const int index = m_hubTrackList->currentTrack();
+    m_currentIndexRefreshPending = false;
+
+    if (!m_hubTrackList) {
+        qCWarning(aalPlaylist) << "Can't refresh the current index without a track list";
+        return;
+    }
+
+    int index;
+    {
+        AAL_BACKEND_CALL("TrackList::currentTrack");
+        index = m_hubTrackList->currentTrack();
+    }
     if (index != m_currentIndex) {
-        qDebug() << "Index changed to" << index;
+        qCDebug(aalPlaylist) << "Index changed to" << index;
         m_currentIndex = index;
         Q_EMIT currentIndexChanged(m_currentIndex);
     }
@@ -291,7 +564,7 @@ void AalMediaPlaylistControl::connect_signals()
     disconnect_signals();
 
     if (!m_hubTrackList) {
-        qWarning() << "Can't connect to track list signals as it doesn't exist";
+        qCWarning(aalPlaylist) << "Can't connect to track list signals as it doesn't exist";
         return;
     }
 
@@ -299,10 +572,13 @@ void AalMediaPlaylistControl::connect_signals()
                      this, &AalMediaPlaylistControl::onTrackChanged);
 
     connect(aalMediaPlaylistProvider(), &AalMediaPlaylistProvider::mediaRemoved,
-            this, &AalMediaPlaylistControl::onMediaRemoved);
+            this, &AalMediaPlaylistControl::onMediaRemoved, Qt::UniqueConnection);
 
     connect(aalMediaPlaylistProvider(), &AalMediaPlaylistProvider::removeTracks,
-            this, &AalMediaPlaylistControl::onRemoveTracks);
+            this, &AalMediaPlaylistControl::onRemoveTracks, Qt::UniqueConnection);
+
+    connect(aalMediaPlaylistProvider(), &AalMediaPlaylistProvider::mediaMoved,
+            this, &AalMediaPlaylistControl::onMediaMoved, Qt::UniqueConnection);
 }
 
 void AalMediaPlaylistControl::disconnect_signals()
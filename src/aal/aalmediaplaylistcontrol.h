@@ -22,11 +22,14 @@
 #include <MediaHub/Player>
 #include <MediaHub/TrackList>
 
+#include <QTimer>
+
 #include <memory>
 
 QT_BEGIN_NAMESPACE
 
 class QMediaPlaylistProvider;
+class AalBackendLock;
 class AalMediaPlaylistProvider;
 
 class AalMediaPlaylistControl : public QMediaPlaylistControl
@@ -44,36 +47,66 @@ public:
     int nextIndex(int steps) const;
     int previousIndex(int steps) const;
 
+    // Move to the neighbouring track right away when its index is known
+    // here. The first call of a burst is sent to media-hub right away, the
+    // last one once the burst stops.
     void next();
     void previous();
+    // The track a skip is headed for while the goTo() hasn't been sent yet,
+    // -1 if there is none
+    int pendingSkip() const { return m_pendingSkip; }
 
+    // The mode last set or reported, without asking media-hub
     QMediaPlaylist::PlaybackMode playbackMode() const;
     void setPlaybackMode(QMediaPlaylist::PlaybackMode mode);
+    // Sends a mode set while there was no player session to media-hub
+    void applyPendingPlaybackMode();
 
     void setPlayerSession(const std::shared_ptr<lomiri::MediaHub::Player>& playerSession);
+    // The owning service's lock, taken around every media-hub call
+    void setBackendLock(AalBackendLock *lock) { m_backendLock = lock; }
 
 Q_SIGNALS:
     void playlistProviderChanged();
     void currentIndexChanged(int position);
     void currentMediaChanged(const QMediaContent&);
     void playbackModeChanged(QMediaPlaylist::PlaybackMode mode);
+    // Forwarded from AalMediaPlaylistProvider::loadProgress(). Not part of
+    // QMediaPlaylistControl, so connect to it by name.
+    void loadProgress(int loaded, int total);
 
 private Q_SLOTS:
     void onTrackChanged();
     void onMediaRemoved(int start, int end);
     void onRemoveTracks(int start, int end);
-    void onCurrentIndexChanged();
+    void onMediaMoved(int from, int to);
+    void onCurrentIndexChanged(int first);
+    void refreshCurrentIndex();
+    void commitSkip();
+    void refreshPlaybackMode();
 
 private:
     void connect_signals();
     void disconnect_signals();
     inline AalMediaPlaylistProvider* aalMediaPlaylistProvider();
+    bool canSkipTo(int index, bool wraps) const;
+    void skipTo(int index);
+    AalBackendLock *backendLock() const { return m_backendLock; }
 
     std::shared_ptr<lomiri::MediaHub::Player> m_hubPlayerSession;
     lomiri::MediaHub::TrackList *m_hubTrackList;
     QMediaPlaylistProvider *m_playlistProvider;
 
     int m_currentIndex;
+    bool m_currentIndexRefreshPending;
+    int m_pendingSkip;
+    // The goTo() sent for the last skip, until media-hub reports it
+    int m_sentSkip;
+    QTimer m_skipTimer;
+    QMediaPlaylist::PlaybackMode m_playbackMode;
+    bool m_playbackModePending;
+    bool m_settingPlaybackMode;
+    AalBackendLock *m_backendLock;
 };
 
 QT_END_NAMESPACE
@@ -14,7 +14,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "aalbackendwatchdog.h"
 #include "aalmediaplaylistprovider.h"
+#include "aallogging.h"
 #include "aalutility.h"
 
 #include <string>
@@ -29,9 +31,37 @@ namespace media = lomiri::MediaHub;
 
 QT_BEGIN_NAMESPACE
 
+namespace
+{
+const int DefaultLoadChunkSize = 100;
+// How long media-hub gets to report a chunk or an edit before whatever
+// waits for it is given up
+const int HubStallTimeoutMs = 5000;
+}
+
 AalMediaPlaylistProvider::AalMediaPlaylistProvider(QObject *parent):
-    QMediaPlaylistProvider(parent)
+    QMediaPlaylistProvider(parent),
+    m_pendingOffset(0),
+    m_loadChunkSize(DefaultLoadChunkSize),
+    m_chunkInFlight(0),
+    m_chunkBase(0),
+    m_editsInFlight(0),
+    m_runningDeferredEdits(false),
+    m_silentTracks(0),
+    m_backendLock(nullptr)
 {
+    bool ok = false;
+    const int chunkSize = qgetenv("QTUBUNTU_MEDIA_LOAD_CHUNK_SIZE").toInt(&ok);
+    if (ok && chunkSize > 0)
+        m_loadChunkSize = chunkSize;
+
+    m_chunkTimer.setSingleShot(true);
+    m_chunkTimer.setInterval(0);
+    connect(&m_chunkTimer, &QTimer::timeout, this, &AalMediaPlaylistProvider::loadNextChunk);
+
+    m_stallTimer.setSingleShot(true);
+    m_stallTimer.setInterval(HubStallTimeoutMs);
+    connect(&m_stallTimer, &QTimer::timeout, this, &AalMediaPlaylistProvider::onLoadStalled);
 }
 
 AalMediaPlaylistProvider::~AalMediaPlaylistProvider()
@@ -40,51 +70,89 @@ AalMediaPlaylistProvider::~AalMediaPlaylistProvider()
 }
 
 int AalMediaPlaylistProvider::mediaCount() const
+{
+    return loadedMediaCount() + pendingMediaCount();
+}
+
+int AalMediaPlaylistProvider::hubMediaCount() const
 {
     if (!m_hubTrackList) {
-        qWarning() << "Tracklist doesn't exist";
+        qCWarning(aalPlaylist) << "Tracklist doesn't exist";
         return 0;
     }
 
+    AAL_BACKEND_CALL("TrackList::tracks");
     return m_hubTrackList->tracks().count();
 }
 
+int AalMediaPlaylistProvider::loadedMediaCount() const
+{
+    // Until media-hub reports a chunk, whether its track list has it yet is
+    // anybody's guess
+    return m_chunkInFlight > 0 ? m_chunkBase : hubMediaCount();
+}
+
+int AalMediaPlaylistProvider::pendingMediaCount() const
+{
+    return m_pendingUris.size() - m_pendingOffset + m_chunkInFlight;
+}
+
 QMediaContent AalMediaPlaylistProvider::media(int index) const
 {
-    int trackCount = mediaCount();
-    if (index < 0 || index >= trackCount)
+    const int hubCount = loadedMediaCount();
+    if (index >= hubCount) {
+        const int pending = m_pendingOffset - m_chunkInFlight + index - hubCount;
+        if (pending >= m_pendingUris.size())
+            return QMediaContent();
+        return QMediaContent(m_pendingUris[pending]);
+    }
+
+    if (index < 0)
         return QMediaContent();
 
-    const media::Track &track = m_hubTrackList->tracks()[index];
-    return QMediaContent(track.uri());
+    QUrl uri;
+    {
+        AAL_BACKEND_CALL("TrackList::tracks");
+        uri = m_hubTrackList->tracks()[index].uri();
+    }
+    return QMediaContent(uri);
 }
 
 bool AalMediaPlaylistProvider::isReadOnly() const
 {
     if (!m_hubTrackList) {
-        qWarning() << "Track list does not exist!";
+        qCWarning(aalPlaylist) << "Track list does not exist!";
         return false;
     }
 
+    AAL_BACKEND_CALL("TrackList::canEditTracks");
     return !m_hubTrackList->canEditTracks();
 }
 
 bool AalMediaPlaylistProvider::addMedia(const QMediaContent &content)
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlaylist) << Q_FUNC_INFO;
 
     if (!m_hubTrackList) {
-        qWarning() << "Track list does not exist so can't add a new track";
+        qCWarning(aalPlaylist) << "Track list does not exist so can't add a new track";
         return false;
     }
 
     const QUrl url = content.canonicalUrl();
 
+    // Keep the order of tracks if a chunked load is still in progress
+    if (isLoading()) {
+        appendPendingTracks({ url });
+        return true;
+    }
+
     static const bool make_current = false;
 
     const int newIndex = mediaCount();
     Q_EMIT mediaAboutToBeInserted(newIndex, newIndex);
-    qDebug() << "Adding track " << url;
+    qCDebug(aalPlaylist) << "Adding track " << url;
+    ++m_editsInFlight;
+    AAL_BACKEND_CALL("TrackList::addTrackWithUriAt");
     m_hubTrackList->addTrackWithUriAt(url, -1, make_current);
 
     return true;
@@ -92,13 +160,13 @@ bool AalMediaPlaylistProvider::addMedia(const QMediaContent &content)
 
 bool AalMediaPlaylistProvider::addMedia(const QList<QMediaContent> &contentList)
 {
-    qDebug() << Q_FUNC_INFO << " num " << contentList.size();
+    qCDebug(aalPlaylist) << Q_FUNC_INFO << " num " << contentList.size();
 
     if (contentList.empty())
         return false;
 
     if (!m_hubTrackList) {
-        qWarning() << "Track list does not exist so can't add new tracks";
+        qCWarning(aalPlaylist) << "Track list does not exist so can't add new tracks";
         return false;
     }
 
@@ -106,88 +174,335 @@ bool AalMediaPlaylistProvider::addMedia(const QList<QMediaContent> &contentList)
     uris.reserve(contentList.count());
     for (const auto mediaContent : contentList) {
 #ifdef VERBOSE_DEBUG
-        qDebug() << "Adding track " << mediaContent.canonicalUrl().toString().toStdString();
+        qCDebug(aalPlaylist) << "Adding track " << mediaContent.canonicalUrl().toString().toStdString();
 #endif
         uris.append(mediaContent.canonicalUrl());
     }
 
+    if (isLoading()) {
+        appendPendingTracks(uris);
+        return true;
+    }
+
+    if (uris.size() <= m_loadChunkSize) {
+        addTracks(uris);
+        return true;
+    }
+
+    // The whole list is in the playlist right away, the first chunk is sent
+    // now so playback can start and the rest follows from loadNextChunk() as
+    // media-hub confirms each chunk
+    m_pendingOffset = 0;
+    appendPendingTracks(uris);
+    loadNextChunk();
+
+    return true;
+}
+
+void AalMediaPlaylistProvider::addTracks(const QVector<QUrl> &uris)
+{
     const int newIndex = mediaCount();
-    Q_EMIT mediaAboutToBeInserted(newIndex, newIndex + contentList.size() - 1);
+    Q_EMIT mediaAboutToBeInserted(newIndex, newIndex + uris.size() - 1);
+    ++m_editsInFlight;
+    AAL_BACKEND_CALL("TrackList::addTracksWithUriAt");
     m_hubTrackList->addTracksWithUriAt(uris, -1);
+}
 
-    return true;
+void AalMediaPlaylistProvider::appendPendingTracks(const QVector<QUrl> &uris)
+{
+    const int first = mediaCount();
+    Q_EMIT mediaAboutToBeInserted(first, first + uris.size() - 1);
+    m_pendingUris += uris;
+    Q_EMIT mediaInserted(first, first + uris.size() - 1);
 }
 
-bool AalMediaPlaylistProvider::insertMedia(int index, const QMediaContent &content)
+void AalMediaPlaylistProvider::restoreTracks(const QVector<QUrl> &uris)
 {
-    int trackCount = mediaCount();
-    if (index < 0 or index >= trackCount) {
-        qWarning() << Q_FUNC_INFO << "index is out of valid range";
-        return false;
+    if (!m_hubTrackList || uris.isEmpty())
+        return;
+
+    // The playlist never lost these tracks, only media-hub needs them again
+    m_silentTracks += uris.size();
+    AAL_BACKEND_CALL("TrackList::addTracksWithUriAt");
+    m_hubTrackList->addTracksWithUriAt(uris, -1);
+}
+
+void AalMediaPlaylistProvider::loadNextChunk()
+{
+    if (!m_hubTrackList || m_chunkInFlight > 0)
+        return;
+
+    const int count = qMin(m_loadChunkSize, m_pendingUris.size() - m_pendingOffset);
+    if (count <= 0)
+        return;
+
+    // Wait for edits already sent, see m_editsInFlight
+    if (m_editsInFlight > 0) {
+        if (!m_stallTimer.isActive())
+            m_stallTimer.start();
+        return;
     }
 
-    const QUrl url = content.canonicalUrl();
-    qDebug() << "after_this_track:" << index;
+    // The chunk counts as sent before media-hub can possibly answer
+    const QVector<QUrl> chunk = m_pendingUris.mid(m_pendingOffset, count);
+    m_chunkBase = hubMediaCount();
+    m_pendingOffset += count;
+    m_chunkInFlight = count;
+    m_stallTimer.start();
 
-    static const bool make_current = false;
-    Q_EMIT mediaAboutToBeInserted(index, index);
-    m_hubTrackList->addTrackWithUriAt(url, index, make_current);
+    AAL_BACKEND_CALL("TrackList::addTracksWithUriAt");
+    m_hubTrackList->addTracksWithUriAt(chunk, -1);
+}
+
+void AalMediaPlaylistProvider::cancelLoading()
+{
+    m_chunkTimer.stop();
+    m_pendingUris.clear();
+    m_pendingOffset = 0;
+    m_chunkInFlight = 0;
+}
+
+void AalMediaPlaylistProvider::onLoadStalled()
+{
+    qCWarning(aalPlaylist) << "media-hub didn't confirm" << m_chunkInFlight << "loaded tracks and"
+                           << m_editsInFlight << "edits in time";
+    m_editsInFlight = 0;
+
+    // What media-hub got of the load stays, the rest is given up. Should it
+    // report the chunk after all, the playlist has it already.
+    if (m_chunkInFlight > 0) {
+        const int total = mediaCount();
+        const int kept = hubMediaCount();
+        m_silentTracks += m_chunkInFlight;
+        if (kept < total)
+            Q_EMIT mediaAboutToBeRemoved(kept, total - 1);
+        cancelLoading();
+        if (kept < total)
+            Q_EMIT mediaRemoved(kept, total - 1);
+    }
+
+    // They were meant for the tracks as they were before
+    if (!m_deferredEdits.isEmpty()) {
+        qCWarning(aalPlaylist) << "Dropping" << m_deferredEdits.size() << "playlist edits";
+        m_deferredEdits.clear();
+    }
+
+    if (isLoading())
+        m_chunkTimer.start();
+}
 
+void AalMediaPlaylistProvider::onHubConfirmed()
+{
+    if (m_chunkInFlight == 0 && m_pendingOffset == m_pendingUris.size() && m_pendingOffset > 0)
+        cancelLoading();
+
+    if (!m_runningDeferredEdits) {
+        m_runningDeferredEdits = true;
+        while (!m_deferredEdits.isEmpty()) {
+            // Taken off before running, it may get media-hub to confirm
+            // something and end up back here
+            const auto edit = m_deferredEdits.takeFirst();
+            if (edit() == EditWaiting) {
+                m_deferredEdits.prepend(edit);
+                break;
+            }
+        }
+        m_runningDeferredEdits = false;
+    }
+
+    // Only send the next chunk once the previous one is in the track list,
+    // so the GUI gets a frame in between
+    if (isLoading())
+        m_chunkTimer.start();
+
+    // Give media-hub another while to answer whatever is still outstanding
+    if (m_chunkInFlight == 0 && m_editsInFlight == 0 && m_deferredEdits.isEmpty())
+        m_stallTimer.stop();
+    else
+        m_stallTimer.start();
+}
+
+bool AalMediaPlaylistProvider::isWaitingForHub() const
+{
+    // The split between tracks media-hub has and the ones it will get is
+    // only known once it has reported everything it was sent
+    return m_chunkInFlight > 0 || (isLoading() && m_editsInFlight > 0);
+}
+
+bool AalMediaPlaylistProvider::runEdit(const std::function<EditResult()> &edit)
+{
+    // Edits are applied in the order they were made
+    if (m_deferredEdits.isEmpty()) {
+        const EditResult result = edit();
+        if (result != EditWaiting)
+            return result == EditDone;
+    }
+
+    m_deferredEdits.append(edit);
+    if (!m_stallTimer.isActive())
+        m_stallTimer.start();
     return true;
 }
 
+void AalMediaPlaylistProvider::whenAvailable(int index, const std::function<void()> &action)
+{
+    runEdit([this, index, action]() {
+        if (m_chunkInFlight > 0 || index >= hubMediaCount()) {
+            if (isLoading() || m_silentTracks > 0)
+                return EditWaiting;
+            qCWarning(aalPlaylist) << "Track" << index << "doesn't exist";
+            return EditFailed;
+        }
+        action();
+        return EditDone;
+    });
+}
+
+bool AalMediaPlaylistProvider::insertMedia(int index, const QMediaContent &content)
+{
+    return runEdit([this, index, content]() {
+        return insertTracks(index, { content.canonicalUrl() });
+    });
+}
+
 bool AalMediaPlaylistProvider::insertMedia(int index, const QList<QMediaContent> &content)
 {
-    (void) index;
-    (void) content;
+    qCDebug(aalPlaylist) << Q_FUNC_INFO << " num " << content.size();
+
+    if (content.empty())
+        return false;
+
+    QVector<QUrl> uris;
+    uris.reserve(content.count());
+    for (const auto mediaContent : content) {
+#ifdef VERBOSE_DEBUG
+        qCDebug(aalPlaylist) << "Inserting track " << mediaContent.canonicalUrl().toString().toStdString();
+#endif
+        uris.append(mediaContent.canonicalUrl());
+    }
+
+    return runEdit([this, index, uris]() { return insertTracks(index, uris); });
+}
+
+AalMediaPlaylistProvider::EditResult AalMediaPlaylistProvider::insertTracks(int index, const QVector<QUrl> &uris)
+{
+    if (isWaitingForHub())
+        return EditWaiting;
+
+    const int hubCount = hubMediaCount();
+    if (index < 0 or index >= hubCount + pendingMediaCount()) {
+        qCWarning(aalPlaylist) << Q_FUNC_INFO << "index is out of valid range";
+        return EditFailed;
+    }
+
+    const int last = index + uris.size() - 1;
+    qCDebug(aalPlaylist) << "after_this_track:" << index;
+
+    // Goes along with the rest of the load
+    if (index >= hubCount) {
+        Q_EMIT mediaAboutToBeInserted(index, last);
+        for (int i = 0; i < uris.size(); ++i)
+            m_pendingUris.insert(m_pendingOffset + index - hubCount + i, uris[i]);
+        Q_EMIT mediaInserted(index, last);
+        return EditDone;
+    }
 
-    qWarning() << Q_FUNC_INFO << " - Not yet implemented";
+    Q_EMIT mediaAboutToBeInserted(index, last);
+    ++m_editsInFlight;
+    if (uris.size() == 1) {
+        static const bool make_current = false;
+        AAL_BACKEND_CALL("TrackList::addTrackWithUriAt");
+        m_hubTrackList->addTrackWithUriAt(uris.first(), index, make_current);
+    } else {
+        // One call for the whole batch rather than one addTrackWithUriAt() per track
+        AAL_BACKEND_CALL("TrackList::addTracksWithUriAt");
+        m_hubTrackList->addTracksWithUriAt(uris, index);
+    }
 
-    return false;
+    return EditDone;
 }
 
 bool AalMediaPlaylistProvider::moveMedia(int from, int to)
 {
-    int trackCount = mediaCount();
+    return runEdit([this, from, to]() { return moveTrack(from, to); });
+}
+
+AalMediaPlaylistProvider::EditResult AalMediaPlaylistProvider::moveTrack(int from, int to)
+{
+    if (isWaitingForHub())
+        return EditWaiting;
+
+    const int hubCount = hubMediaCount();
+    const int trackCount = hubCount + pendingMediaCount();
     if (from < 0 or from >= trackCount) {
-        qWarning() << "Failed to moveMedia(), index 'from' is out of valid range";
-        return false;
+        qCWarning(aalPlaylist) << "Failed to moveMedia(), index 'from' is out of valid range";
+        return EditFailed;
     }
 
     if (to < 0 or to >= trackCount) {
-        qWarning() << "Failed to moveMedia(), index 'to' is out of valid range";
-        return false;
+        qCWarning(aalPlaylist) << "Failed to moveMedia(), index 'to' is out of valid range";
+        return EditFailed;
     }
 
     if (from == to)
-        return true;
+        return EditDone;
+
+    if (from >= hubCount && to >= hubCount) {
+        m_pendingUris.move(m_pendingOffset + from - hubCount, m_pendingOffset + to - hubCount);
+        Q_EMIT mediaChanged(qMin(from, to), qMax(from, to));
+        Q_EMIT mediaMoved(from, to);
+        return EditDone;
+    }
+
+    // A move between the tracks media-hub has and those it doesn't have yet
+    // waits for the load to complete
+    if (from >= hubCount || to >= hubCount)
+        return EditWaiting;
 
     // This must be emitted before the move_track occurs or things in AalMediaPlaylistControl
     // such as m_currentId won't be accurate
     Q_EMIT startMoveTrack(from, to);
 
-    qDebug() << "************ New track move:" << from << "to" << to;
-    Q_EMIT mediaAboutToBeRemoved(from, from);
-    int insertedIndex = to > from ? (to - 1) : to;
-    Q_EMIT mediaAboutToBeInserted(insertedIndex, insertedIndex);
+    qCDebug(aalPlaylist) << "************ New track move:" << from << "to" << to;
 
+    ++m_editsInFlight;
+    AAL_BACKEND_CALL("TrackList::moveTrack");
     m_hubTrackList->moveTrack(from, to);
 
-    return true;
+    return EditDone;
 }
 
 bool AalMediaPlaylistProvider::removeMedia(int pos)
 {
-    int trackCount = mediaCount();
-    if (pos < 0 or pos >= trackCount) {
-        qWarning() << Q_FUNC_INFO << "index is out of valid range";
-        return false;
+    return runEdit([this, pos]() { return removeTrack(pos); });
+}
+
+AalMediaPlaylistProvider::EditResult AalMediaPlaylistProvider::removeTrack(int pos)
+{
+    if (isWaitingForHub())
+        return EditWaiting;
+
+    const int hubCount = hubMediaCount();
+    if (pos < 0 or pos >= hubCount + pendingMediaCount()) {
+        qCWarning(aalPlaylist) << Q_FUNC_INFO << "index is out of valid range";
+        return EditFailed;
+    }
+
+    if (pos >= hubCount) {
+        Q_EMIT mediaAboutToBeRemoved(pos, pos);
+        m_pendingUris.remove(m_pendingOffset + pos - hubCount);
+        if (!isLoading())
+            cancelLoading();
+        Q_EMIT mediaRemoved(pos, pos);
+        return EditDone;
     }
 
     Q_EMIT mediaAboutToBeRemoved(pos, pos);
+    ++m_editsInFlight;
+    AAL_BACKEND_CALL("TrackList::removeTrack");
     m_hubTrackList->removeTrack(pos);
 
-    return true;
+    return EditDone;
 }
 
 bool AalMediaPlaylistProvider::removeMedia(int start, int end)
@@ -208,7 +523,7 @@ bool AalMediaPlaylistProvider::removeMedia(int start, int end)
         {
             if (!removeMedia(i))
             {
-                qWarning() << "Failed to remove the full range of tracks requested";
+                qCWarning(aalPlaylist) << "Failed to remove the full range of tracks requested";
                 return false;
             }
         }
@@ -220,13 +535,26 @@ bool AalMediaPlaylistProvider::removeMedia(int start, int end)
 bool AalMediaPlaylistProvider::clear()
 {
     int trackCount = mediaCount();
+
+    // Tracks that weren't sent to media-hub yet go away along with the rest,
+    // as do the edits still waiting for them. A chunk already sent is
+    // reported before the reset, and mustn't show up again.
+    m_silentTracks += m_chunkInFlight;
+    cancelLoading();
+    m_deferredEdits.clear();
+    m_editsInFlight = 0;
+    m_stallTimer.stop();
+
     if (trackCount == 0) {
-        qWarning() << "Track list doesn't exist so can't clear it!";
+        qCWarning(aalPlaylist) << "Track list doesn't exist so can't clear it!";
         return false;
     }
 
     Q_EMIT mediaAboutToBeRemoved(0, trackCount - 1);
-    m_hubTrackList->reset();
+    {
+        AAL_BACKEND_CALL("TrackList::reset");
+        m_hubTrackList->reset();
+    }
 
     // We do not wait for the TrackListReset signal to empty the lut to
     // avoid sync problems.
@@ -248,9 +576,26 @@ bool AalMediaPlaylistProvider::isTrackEnd(int index)
 void AalMediaPlaylistProvider::setPlayerSession(const std::shared_ptr<lomiri::MediaHub::Player> &playerSession)
 {
     m_hubPlayerSession = playerSession;
+    m_silentTracks = 0;
+
+    // A new session starts from the tracks the playlist had, see
+    // AalMediaPlayerService::captureSession()
+    cancelLoading();
+    m_deferredEdits.clear();
+    m_editsInFlight = 0;
+    m_stallTimer.stop();
+
+    // The session is being released, see AalMediaPlayerService::detachSession()
+    if (!m_hubPlayerSession) {
+        m_hubTrackList.reset();
+        return;
+    }
 
     m_hubTrackList.reset(new media::TrackList);
-    m_hubPlayerSession->setTrackList(m_hubTrackList.get());
+    {
+        AAL_BACKEND_CALL("Player::setTrackList");
+        m_hubPlayerSession->setTrackList(m_hubTrackList.get());
+    }
 
     /* Disconnect first to avoid duplicated calls */
     disconnect_signals();
@@ -260,51 +605,77 @@ void AalMediaPlaylistProvider::setPlayerSession(const std::shared_ptr<lomiri::Me
 void AalMediaPlaylistProvider::connect_signals()
 {
     if (!m_hubTrackList) {
-        qWarning() << "Can't connect to track list signals as it doesn't exist";
+        qCWarning(aalPlaylist) << "Can't connect to track list signals as it doesn't exist";
         return;
     }
 
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlaylist) << Q_FUNC_INFO;
 
     QObject::connect(m_hubTrackList.get(), &media::TrackList::tracksAdded,
                      this, [this](int start, int end)
     {
-        qDebug() << "mediaInserted, first_index: " << start << " last_index: " << end;
-        Q_EMIT mediaInserted(start, end);
-        Q_EMIT currentIndexChanged();
+        const int count = end - start + 1;
+        // Progress is taken before onHubConfirmed() may end the load
+        int loaded = -1;
+        int total = 0;
+        if (m_chunkInFlight > 0) {
+            // Part of a load, the playlist has these tracks already
+            m_chunkInFlight = qMax(0, m_chunkInFlight - count);
+            if (m_chunkInFlight == 0) {
+                loaded = m_pendingOffset;
+                total = m_pendingUris.size();
+            }
+        } else if (m_silentTracks > 0) {
+            m_silentTracks -= count;
+        } else {
+            m_editsInFlight = qMax(0, m_editsInFlight - 1);
+            qCDebug(aalPlaylist) << "mediaInserted, first_index: " << start << " last_index: " << end;
+            Q_EMIT mediaInserted(start, end);
+            Q_EMIT currentIndexChanged(start);
+        }
+
+        onHubConfirmed();
+        if (loaded >= 0)
+            Q_EMIT loadProgress(loaded, total);
     });
 
     QObject::connect(m_hubTrackList.get(), &media::TrackList::trackRemoved,
                      this, [this](int index)
     {
-        qDebug() << "*** Removing track with index " << index;
+        qCDebug(aalPlaylist) << "*** Removing track with index " << index;
 
+        m_editsInFlight = qMax(0, m_editsInFlight - 1);
         // Removed one track, so start and end are the same index values
         Q_EMIT mediaRemoved(index, index);
-        Q_EMIT currentIndexChanged();
+        Q_EMIT currentIndexChanged(index);
+        onHubConfirmed();
     });
 
     QObject::connect(m_hubTrackList.get(), &media::TrackList::trackMoved,
                      this, [this](int from, int to)
     {
-        qDebug() << "Track moved from" << from << "to" << to;
-
-        Q_EMIT mediaRemoved(from, from);
-        int insertedIndex = to > from ? (to - 1) : to;
-        Q_EMIT mediaInserted(insertedIndex, insertedIndex);
-        Q_EMIT currentIndexChanged();
+        qCDebug(aalPlaylist) << "Track moved from" << from << "to" << to;
+
+        // QMediaPlaylist has no notion of moved rows, so report the shifted
+        // range as changed data. Unlike a remove + insert pair this keeps the
+        // existing delegates of a QML view alive.
+        m_editsInFlight = qMax(0, m_editsInFlight - 1);
+        Q_EMIT mediaChanged(qMin(from, to), qMax(from, to));
+        // AalMediaPlaylistControl works out the current index from this
+        Q_EMIT mediaMoved(from, to);
+        onHubConfirmed();
     });
 
     QObject::connect(m_hubTrackList.get(), &media::TrackList::trackListReset,
                      this, [this]()
     {
-        qDebug() << "TrackListReset signal received";
+        qCDebug(aalPlaylist) << "TrackListReset signal received";
     });
 }
 
 void AalMediaPlaylistProvider::disconnect_signals()
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalPlaylist) << Q_FUNC_INFO;
 
     QObject::disconnect(m_hubTrackList.get(), nullptr, this, nullptr);
 }
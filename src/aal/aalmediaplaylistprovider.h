@@ -23,19 +23,25 @@
 #include <MediaHub/Track>
 #include <MediaHub/TrackList>
 
+#include <QList>
 #include <QScopedPointer>
+#include <QTimer>
+#include <QVector>
 #include <atomic>
+#include <functional>
 #include <memory>
 
 QT_BEGIN_NAMESPACE
 
 class AalMediaPlaylistControl;
+class AalBackendLock;
 
 class AalMediaPlaylistProvider : public QMediaPlaylistProvider
 {
 Q_OBJECT
 public:
     friend class AalMediaPlaylistControl;
+    friend class AalMediaPlayerService;
 
     AalMediaPlaylistProvider(QObject *parent=0);
     ~AalMediaPlaylistProvider();
@@ -56,19 +62,84 @@ public:
 
     bool isTrackEnd(int index/* TODO const ContainerTrackLut::const_iterator &it*/);
 
+    // Long lists given to addMedia() are handed to media-hub in chunks, one
+    // chunk per event loop pass, so the first track is playable right away
+    // and the GUI keeps rendering while the rest loads. The playlist has all
+    // tracks from the start: mediaCount() and media() cover the ones
+    // media-hub doesn't have yet, and edits are applied to them here or
+    // wait until media-hub has caught up with them.
+    bool isLoading() const { return pendingMediaCount() > 0; }
+    // Tracks in the playlist media-hub doesn't have yet
+    int pendingMediaCount() const;
+    // Runs action once media-hub has the track at index, after the edits
+    // that are waiting already
+    void whenAvailable(int index, const std::function<void()> &action);
+
+    // The owning service's lock, taken around every media-hub call
+    void setBackendLock(AalBackendLock *lock) { m_backendLock = lock; }
+
 Q_SIGNALS:
     void startMoveTrack(int from, int to);
-    void currentIndexChanged();
+    // A track media-hub moved, 'to' being its index after the move.
+    // QMediaPlaylist only learns about it as mediaChanged() over the rows
+    // in between.
+    void mediaMoved(int from, int to);
+    // 'first' is the lowest index touched by the edit. Edits that start after
+    // the current track can't move it, so listeners may skip those.
+    void currentIndexChanged(int first);
     // Emitted when removing a range of tracks less than mediaCount()
     // so that AalMediaPlaylistControl can take appropriate action
     void removeTracks(int start, int end);
+    // Emitted whenever media-hub has confirmed a chunk of a chunked
+    // addMedia(), loaded == total once it completes
+    void loadProgress(int loaded, int total);
+
+private Q_SLOTS:
+    void loadNextChunk();
+    void onLoadStalled();
 
 private:
+    enum EditResult { EditDone, EditFailed, EditWaiting };
+
+    int hubMediaCount() const;
+    int loadedMediaCount() const;
+    bool isWaitingForHub() const;
+    void addTracks(const QVector<QUrl> &uris);
+    void appendPendingTracks(const QVector<QUrl> &uris);
+    EditResult insertTracks(int index, const QVector<QUrl> &uris);
+    EditResult removeTrack(int pos);
+    EditResult moveTrack(int from, int to);
+    bool runEdit(const std::function<EditResult()> &edit);
+    void onHubConfirmed();
+    // Puts tracks the playlist already has into a new track list, without
+    // announcing them as inserted
+    void restoreTracks(const QVector<QUrl> &uris);
+    void cancelLoading();
+    AalBackendLock *backendLock() const { return m_backendLock; }
+
     void setPlayerSession(const std::shared_ptr<lomiri::MediaHub::Player> &playerSession);
     void connect_signals();
     void disconnect_signals();
     std::shared_ptr<lomiri::MediaHub::Player> m_hubPlayerSession;
     QScopedPointer<lomiri::MediaHub::TrackList> m_hubTrackList;
+
+    // Tracks of the running load, those before m_pendingOffset were sent
+    QVector<QUrl> m_pendingUris;
+    int m_pendingOffset;
+    int m_loadChunkSize;
+    QTimer m_chunkTimer;
+    // Sent tracks media-hub hasn't reported yet, and how many it had before
+    int m_chunkInFlight;
+    int m_chunkBase;
+    // Edits sent to media-hub it hasn't reported yet. Chunks are only sent
+    // when there are none, so tracksAdded() can tell them apart.
+    int m_editsInFlight;
+    QList<std::function<EditResult()>> m_deferredEdits;
+    bool m_runningDeferredEdits;
+    QTimer m_stallTimer;
+    // Tracks still to be added by restoreTracks()
+    int m_silentTracks;
+    AalBackendLock *m_backendLock;
 };
 
 QT_END_NAMESPACE
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aalbackendwatchdog.h"
+#include "aalplayercommandqueue.h"
+#include "aallogging.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QTimer>
+
+#include <stdexcept>
+
+namespace media = lomiri::MediaHub;
+
+AalPlayerCommandQueue::AalPlayerCommandQueue(bool threaded, QObject *parent)
+    : QObject(parent),
+      m_threaded(threaded),
+      m_processScheduled(false),
+      m_busy(false),
+      m_coalescedCommands(0)
+{
+    if (m_threaded) {
+        m_backendLock.setEnabled(true);
+        m_thread.setObjectName(QStringLiteral("MediaHubCommands"));
+        m_worker.moveToThread(&m_thread);
+        m_thread.start();
+    }
+}
+
+AalPlayerCommandQueue::~AalPlayerCommandQueue()
+{
+    if (m_threaded) {
+        flush();
+        m_thread.quit();
+        m_thread.wait();
+    }
+}
+
+void AalPlayerCommandQueue::setPlayer(const std::shared_ptr<media::Player> &player)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        // The session must not be released from the worker thread
+        while (m_busy)
+            m_idle.wait(&m_mutex);
+
+        m_commands.clear();
+        m_player = player;
+        m_state = AalPlayerState();
+    }
+
+    // A new session starts out with a state of its own
+    if (m_threaded && player)
+        refreshState();
+}
+
+void AalPlayerCommandQueue::openUri(const QUrl &uri, const media::Player::Headers &headers)
+{
+    enqueue(Other, "Player::openUri",
+            [uri, headers](media::Player *player) { player->openUri(uri, headers); });
+}
+
+void AalPlayerCommandQueue::play()
+{
+    enqueue(Transport, "Player::play", [](media::Player *player) { player->play(); });
+}
+
+void AalPlayerCommandQueue::pause()
+{
+    enqueue(Transport, "Player::pause", [](media::Player *player) { player->pause(); });
+}
+
+void AalPlayerCommandQueue::stop()
+{
+    enqueue(Transport, "Player::stop", [](media::Player *player) { player->stop(); });
+}
+
+void AalPlayerCommandQueue::seekTo(quint64 microseconds)
+{
+    enqueue(Seek, "Player::seekTo",
+            [microseconds](media::Player *player) { player->seekTo(microseconds); });
+}
+
+void AalPlayerCommandQueue::setVolume(media::Player::Volume volume)
+{
+    enqueue(Volume, "Player::setVolume", [volume](media::Player *player) { player->setVolume(volume); });
+}
+
+void AalPlayerCommandQueue::setPlaybackRate(media::Player::PlaybackRate rate)
+{
+    enqueue(PlaybackRate, "Player::setPlaybackRate",
+            [rate](media::Player *player) { player->setPlaybackRate(rate); });
+}
+
+void AalPlayerCommandQueue::refreshState()
+{
+    enqueue(Refresh, "Player::properties", nullptr);
+}
+
+AalPlayerState AalPlayerCommandQueue::state() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_state;
+}
+
+void AalPlayerCommandQueue::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_busy || !m_commands.isEmpty())
+        m_idle.wait(&m_mutex);
+}
+
+int AalPlayerCommandQueue::pendingCommands() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_commands.size();
+}
+
+quint64 AalPlayerCommandQueue::coalescedCommands() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_coalescedCommands;
+}
+
+void AalPlayerCommandQueue::enqueue(CommandKind kind, const char *name,
+                                    const std::function<void(media::Player*)> &run)
+{
+    const Command command = { kind, name, run };
+
+    if (!m_threaded) {
+        if (m_player && run)
+            runCommand(command, m_player.get());
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_player)
+        return;
+
+    // Only the latest seek, volume, etc. matters, so a command replaces the
+    // one queued right before it if that is of the same kind. A command of
+    // another kind in between keeps both: seek, stop, seek must not turn
+    // into seek, stop.
+    if (kind != Other && !m_commands.isEmpty() && m_commands.last().kind == kind) {
+        m_commands.last() = command;
+        ++m_coalescedCommands;
+        return;
+    }
+
+    m_commands.append(command);
+    if (!m_processScheduled) {
+        m_processScheduled = true;
+        QTimer::singleShot(0, &m_worker, [this]() { processCommands(); });
+    }
+}
+
+void AalPlayerCommandQueue::processCommands()
+{
+    QMutex *backendLock = m_backendLock.mutex();
+    QMutexLocker locker(&m_mutex);
+    m_processScheduled = false;
+
+    bool refreshed = false;
+    while (!m_commands.isEmpty()) {
+        // The backend lock is taken before a command is, so a thread that
+        // holds it in setPlayer() never waits for a command that waits for it
+        locker.unlock();
+        backendLock->lock();
+        locker.relock();
+        if (m_commands.isEmpty()) {
+            backendLock->unlock();
+            break;
+        }
+
+        const Command command = m_commands.takeFirst();
+        media::Player *player = m_player.get();
+        m_busy = true;
+
+        locker.unlock();
+        if (command.run)
+            runCommand(command, player);
+        locker.relock();
+
+        // Once everything is sent, what it did is read back for state()
+        if (m_commands.isEmpty()) {
+            locker.unlock();
+            const AalPlayerState state = readState(player);
+            locker.relock();
+            m_state = state;
+            refreshed = true;
+        }
+
+        locker.unlock();
+        backendLock->unlock();
+        locker.relock();
+
+        m_busy = false;
+        m_idle.wakeAll();
+    }
+
+    m_idle.wakeAll();
+    locker.unlock();
+    if (refreshed)
+        Q_EMIT stateRefreshed();
+}
+
+void AalPlayerCommandQueue::runCommand(const Command &command, media::Player *player)
+{
+    AalBackendCallTimer timer(command.name, Q_FUNC_INFO);
+    try {
+        command.run(player);
+    } catch (const std::exception &e) {
+        qCWarning(aalIpc) << "Failed to send" << command.name << "to media-hub:" << e.what();
+    }
+}
+
+AalPlayerState AalPlayerCommandQueue::readState(media::Player *player)
+{
+    AalPlayerState state;
+    if (!player)
+        return state;
+
+    // The client keeps these in its property cache, so they come without
+    // a round trip each
+    AalBackendCallTimer timer("Player::properties", Q_FUNC_INFO);
+    try {
+        state.playbackStatus = player->playbackStatus();
+        state.position = player->position();
+        state.duration = player->duration();
+        state.isVideoSource = player->isVideoSource();
+        state.isAudioSource = player->isAudioSource();
+        state.volume = player->volume();
+        state.valid = true;
+    } catch (const std::exception &e) {
+        qCWarning(aalIpc) << "Failed to read the player state from media-hub:" << e.what();
+    }
+    return state;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AALPLAYERCOMMANDQUEUE_H
+#define AALPLAYERCOMMANDQUEUE_H
+
+#include "aalbackendwatchdog.h"
+
+#include <MediaHub/Player>
+
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QThread>
+#include <QUrl>
+#include <QWaitCondition>
+
+#include <functional>
+#include <memory>
+
+// What the worker thread of a threaded AalPlayerCommandQueue last read from
+// its session
+struct AalPlayerState
+{
+    // False until the worker read it once
+    bool valid = false;
+    lomiri::MediaHub::Player::PlaybackStatus playbackStatus =
+            lomiri::MediaHub::Player::PlaybackStatus::Null;
+    // As media-hub reports them
+    quint64 position = 0;
+    quint64 duration = 0;
+    bool isVideoSource = false;
+    bool isAudioSource = false;
+    lomiri::MediaHub::Player::Volume volume = 1.0;
+};
+
+// Sends commands to a media-hub player session. When threaded, commands
+// are queued and sent from a worker thread, so the caller never waits for
+// media-hub to answer. A command that only matters for its latest value
+// (seeking, volume, rate, play/pause/stop) replaces the last queued command
+// if that is of the same kind. Otherwise commands are sent right away from
+// the calling thread.
+//
+// Each time the worker has sent everything queued, it reads the session's
+// state back for getters to serve without a round trip, see state().
+//
+// The worker thread shares the session with the thread that owns it, which
+// makes the calls the queue doesn't cover, e.g. track list edits. Both
+// sides go through backendLock(), so the session is only ever used by one
+// thread at a time. Other sessions have locks of their own.
+class AalPlayerCommandQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AalPlayerCommandQueue(bool threaded, QObject *parent = 0);
+    ~AalPlayerCommandQueue();
+
+    bool isThreaded() const { return m_threaded; }
+    // Enabled while threaded
+    AalBackendLock *backendLock() const { return &m_backendLock; }
+
+    // Queued commands for a previous session are dropped. Waits for a
+    // command that is being sent to finish.
+    void setPlayer(const std::shared_ptr<lomiri::MediaHub::Player> &player);
+
+    void openUri(const QUrl &uri, const lomiri::MediaHub::Player::Headers &headers);
+    void play();
+    void pause();
+    void stop();
+    void seekTo(quint64 microseconds);
+    void setVolume(lomiri::MediaHub::Player::Volume volume);
+    void setPlaybackRate(lomiri::MediaHub::Player::PlaybackRate rate);
+
+    // Has the worker read the session's state again, for when the session
+    // signals a change. Threaded queues only.
+    void refreshState();
+    AalPlayerState state() const;
+
+    // Waits until every command queued so far has been sent. Not to be
+    // called from within a backend call, the worker needs backendLock().
+    void flush();
+
+    int pendingCommands() const;
+    // Commands that were replaced by a later one before being sent
+    quint64 coalescedCommands() const;
+
+Q_SIGNALS:
+    // Emitted from the worker thread once state() was updated
+    void stateRefreshed();
+
+private:
+    enum CommandKind {
+        Transport,
+        Seek,
+        Volume,
+        PlaybackRate,
+        // Sends nothing, only gets the state read
+        Refresh,
+        // Never replaced
+        Other
+    };
+
+    struct Command
+    {
+        CommandKind kind;
+        // The media-hub method, for AalBackendWatchdog
+        const char *name;
+        std::function<void(lomiri::MediaHub::Player*)> run;
+    };
+
+    void enqueue(CommandKind kind, const char *name,
+                 const std::function<void(lomiri::MediaHub::Player*)> &run);
+    // Run on the worker thread
+    void processCommands();
+    static void runCommand(const Command &command, lomiri::MediaHub::Player *player);
+    static AalPlayerState readState(lomiri::MediaHub::Player *player);
+
+    const bool m_threaded;
+    mutable AalBackendLock m_backendLock;
+    QThread m_thread;
+    QObject m_worker;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_idle;
+    std::shared_ptr<lomiri::MediaHub::Player> m_player;
+    QList<Command> m_commands;
+    bool m_processScheduled;
+    bool m_busy;
+    quint64 m_coalescedCommands;
+    AalPlayerState m_state;
+};
+
+#endif // AALPLAYERCOMMANDQUEUE_H
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aalsharedsignalrouter.h"
+#include "aallogging.h"
+#include "aalvideorenderercontrol.h"
+
+#include <qtubuntu_media_signals.h>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QPointer>
+
+namespace
+{
+// Token of the handshake frame qtvideo-node last read on this thread
+thread_local quint64 handshakeToken = 0;
+}
+
+AalSharedSignalRouter::AalSharedSignalRouter(QObject *parent)
+    : QObject(parent),
+      m_nextToken(1)
+{
+    // Direct, so the token noted on the emitting thread can be picked up
+    connect(SharedSignal::instance(), SIGNAL(textureCreated(unsigned int)),
+            this, SLOT(onTextureCreated(unsigned int)), Qt::DirectConnection);
+    connect(SharedSignal::instance(), SIGNAL(glConsumerSet()),
+            this, SLOT(onGLConsumerSet()), Qt::DirectConnection);
+}
+
+AalSharedSignalRouter *AalSharedSignalRouter::instance()
+{
+    // Parented to the application rather than a static, which would outlive
+    // it along with its connections
+    static QPointer<AalSharedSignalRouter> router;
+    if (router.isNull() && QCoreApplication::instance())
+        router = new AalSharedSignalRouter(QCoreApplication::instance());
+    return router.data();
+}
+
+void AalSharedSignalRouter::noteHandshakeFrame(quint64 token)
+{
+    handshakeToken = token;
+}
+
+quint64 AalSharedSignalRouter::registerRenderer(AalVideoRendererControl *renderer)
+{
+    const quint64 token = m_nextToken++;
+    m_renderers.insert(token, renderer);
+    return token;
+}
+
+void AalSharedSignalRouter::unregisterRenderer(quint64 token)
+{
+    cancelExpectations(token);
+    m_renderers.remove(token);
+}
+
+void AalSharedSignalRouter::expectTexture(quint64 token)
+{
+    if (!m_waitingForTexture.contains(token))
+        m_waitingForTexture.enqueue(token);
+}
+
+void AalSharedSignalRouter::expectGLConsumer(quint64 token)
+{
+    if (!m_waitingForGLConsumer.contains(token))
+        m_waitingForGLConsumer.enqueue(token);
+}
+
+void AalSharedSignalRouter::cancelExpectations(quint64 token)
+{
+    m_waitingForTexture.removeAll(token);
+    m_waitingForGLConsumer.removeAll(token);
+}
+
+void AalSharedSignalRouter::onTextureCreated(unsigned int textureId)
+{
+    const quint64 token = handshakeToken;
+    handshakeToken = 0;
+    QMetaObject::invokeMethod(this, "routeTextureCreated",
+                              Q_ARG(quint64, token), Q_ARG(unsigned int, textureId));
+}
+
+void AalSharedSignalRouter::onGLConsumerSet()
+{
+    const quint64 token = handshakeToken;
+    handshakeToken = 0;
+    QMetaObject::invokeMethod(this, "routeGLConsumerSet", Q_ARG(quint64, token));
+}
+
+void AalSharedSignalRouter::routeTextureCreated(quint64 token, unsigned int textureId)
+{
+    AalVideoRendererControl *renderer = takeWaiting(m_waitingForTexture, token);
+    if (!renderer) {
+        qCWarning(aalRenderer) << "No renderer is waiting for texture" << textureId << ", ignoring it";
+        return;
+    }
+
+    renderer->onTextureCreated(textureId);
+}
+
+void AalSharedSignalRouter::routeGLConsumerSet(quint64 token)
+{
+    AalVideoRendererControl *renderer = takeWaiting(m_waitingForGLConsumer, token);
+    if (!renderer) {
+        qCWarning(aalRenderer) << "No renderer is waiting for its video sink to be taken over, ignoring it";
+        return;
+    }
+
+    renderer->onGLConsumerSet();
+}
+
+AalVideoRendererControl *AalSharedSignalRouter::takeWaiting(QQueue<quint64> &queue, quint64 token)
+{
+    if (token != 0 && queue.removeOne(token))
+        return m_renderers.value(token);
+
+    while (!queue.isEmpty()) {
+        AalVideoRendererControl *renderer = m_renderers.value(queue.dequeue());
+        if (renderer)
+            return renderer;
+    }
+    return nullptr;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AALSHAREDSIGNALROUTER_H
+#define AALSHAREDSIGNALROUTER_H
+
+#include <QHash>
+#include <QObject>
+#include <QQueue>
+
+class AalVideoRendererControl;
+
+// The only subscriber of the process wide SharedSignal events qtvideo-node
+// emits, so every event wakes exactly one renderer however many players
+// there are. The events carry no address themselves. Instead the frames of
+// a texture handshake carry the renderer's token, and qtvideo-node reading
+// such a frame notes the token on its thread right before it emits the
+// answer. Events that come without a token go to the renderer that has been
+// waiting for them the longest.
+//
+// This relies on qtvideo-node reading a handshake frame's handle() on the
+// thread that emits the answer, with no other handshake frame read on that
+// thread in between. If two renderers' frames are read before either is
+// answered, the second token replaces the first: the first answer goes to
+// the second renderer and the second answer falls back to the waiting
+// order, so the renderers swap textures.
+//
+// sinkReset is not routed. It is still broadcast to every sink.
+class AalSharedSignalRouter : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Owned by the application, null once it is gone
+    static AalSharedSignalRouter *instance();
+
+    // Called on the thread about to emit a SharedSignal event for the
+    // handshake frame of token
+    static void noteHandshakeFrame(quint64 token);
+
+    // Returns the token the renderer is addressed by
+    quint64 registerRenderer(AalVideoRendererControl *renderer);
+    void unregisterRenderer(quint64 token);
+
+    // To be called right before presenting the frame that makes qtvideo-node
+    // create a texture, respectively take over the video sink
+    void expectTexture(quint64 token);
+    void expectGLConsumer(quint64 token);
+    // Forgets about any handshake the renderer was waiting for
+    void cancelExpectations(quint64 token);
+
+private Q_SLOTS:
+    // Run on the thread emitting the event, see noteHandshakeFrame()
+    void onTextureCreated(unsigned int textureId);
+    void onGLConsumerSet();
+
+    void routeTextureCreated(quint64 token, unsigned int textureId);
+    void routeGLConsumerSet(quint64 token);
+
+private:
+    explicit AalSharedSignalRouter(QObject *parent);
+
+    // Takes token out of the queue if it is waiting, otherwise the first
+    // waiting renderer that is still registered
+    AalVideoRendererControl *takeWaiting(QQueue<quint64> &queue, quint64 token);
+
+    quint64 m_nextToken;
+    QHash<quint64, AalVideoRendererControl*> m_renderers;
+    QQueue<quint64> m_waitingForTexture;
+    QQueue<quint64> m_waitingForGLConsumer;
+};
+
+#endif // AALSHAREDSIGNALROUTER_H
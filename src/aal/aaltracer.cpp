@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aaltracer.h"
+#include "aallogging.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <chrono>
+
+const bool AalTracer::s_enabled = !qgetenv("QTUBUNTU_MEDIA_TRACE_FILE").isEmpty();
+
+AalTracer::AalTracer(const QString &fileName)
+    : m_file(fileName),
+      m_firstEvent(true)
+{
+    // One write() per event and no buffer that a crash would take along
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        qCWarning(aalPlayer) << "Failed to open" << m_file.fileName() << "for tracing:"
+                   << m_file.errorString();
+        return;
+    }
+
+    // Viewers also take a trace that ends before the closing bracket, e.g.
+    // when the application crashed
+    m_file.write("[\n");
+}
+
+AalTracer::~AalTracer()
+{
+    if (m_file.isOpen())
+        m_file.write("\n]\n");
+}
+
+AalTracer *AalTracer::instance()
+{
+    static AalTracer tracer(QString::fromLocal8Bit(qgetenv("QTUBUNTU_MEDIA_TRACE_FILE")));
+    return &tracer;
+}
+
+double AalTracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+void AalTracer::complete(const char *name, const char *category, double start, double duration)
+{
+    writeEvent('X', name, category, start, ",\"dur\":" + QByteArray::number(duration, 'f', 3));
+}
+
+void AalTracer::instant(const char *name, const char *category, const char *argName, qint64 arg)
+{
+    QByteArray extra(",\"s\":\"t\"");
+    if (argName)
+        extra += ",\"args\":{\"" + QByteArray(argName) + "\":" + QByteArray::number(arg) + "}";
+    writeEvent('i', name, category, now(), extra);
+}
+
+void AalTracer::asyncBegin(const char *name, const char *category, quint64 id)
+{
+    writeEvent('b', name, category, now(), ",\"id\":" + QByteArray::number(id));
+}
+
+void AalTracer::asyncEnd(const char *name, const char *category, quint64 id)
+{
+    writeEvent('e', name, category, now(), ",\"id\":" + QByteArray::number(id));
+}
+
+void AalTracer::writeEvent(char phase, const char *name, const char *category, double timestamp,
+                           const QByteArray &extra)
+{
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    const quintptr threadId = reinterpret_cast<quintptr>(QThread::currentThreadId());
+    const QByteArray tid = QByteArray::number(threadId);
+
+    QByteArray event;
+    event.reserve(160);
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_file.isOpen())
+        return;
+
+    if (!m_firstEvent)
+        event += ",\n";
+    m_firstEvent = false;
+
+    // Gives the thread a readable name in the viewer
+    if (!m_namedThreads.contains(threadId)) {
+        m_namedThreads.insert(threadId);
+        QByteArray threadName = QThread::currentThread()->objectName().toUtf8();
+        if (threadName.isEmpty())
+            threadName = qApp && QThread::currentThread() == qApp->thread() ? "main" : "thread " + tid;
+        threadName.replace('"', '\'').replace('\\', '/');
+        event += "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid + ",\"tid\":" + tid
+                + ",\"args\":{\"name\":\"" + threadName + "\"}},\n";
+    }
+
+    event += "{\"ph\":\"";
+    event += phase;
+    event += "\",\"name\":\"" + QByteArray(name) + "\",\"cat\":\"" + QByteArray(category)
+            + "\",\"ts\":" + QByteArray::number(timestamp, 'f', 3)
+            + ",\"pid\":" + pid + ",\"tid\":" + tid + extra + "}";
+
+    m_file.write(event);
+}
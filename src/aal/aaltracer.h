@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AALTRACER_H
+#define AALTRACER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QSet>
+
+// Writes a timeline of what the plugin does to the file named by
+// QTUBUNTU_MEDIA_TRACE_FILE, in the Chrome trace event format that
+// chrome://tracing and Perfetto load. Without the environment variable
+// every trace point boils down to checking a bool. Every event reaches the
+// file as it happens, so a trace survives the application crashing.
+//
+// Names and categories must be string literals.
+class AalTracer
+{
+public:
+    static bool isEnabled() { return s_enabled; }
+    // Writes to QTUBUNTU_MEDIA_TRACE_FILE
+    static AalTracer *instance();
+
+    explicit AalTracer(const QString &fileName);
+    ~AalTracer();
+
+    // Microseconds on the monotonic clock
+    static double now();
+
+    // A span of time on the calling thread
+    void complete(const char *name, const char *category, double start, double duration);
+    void instant(const char *name, const char *category,
+                 const char *argName = nullptr, qint64 arg = 0);
+    // A span that may start and end on different threads. Spans with the
+    // same name are told apart by their id.
+    void asyncBegin(const char *name, const char *category, quint64 id);
+    void asyncEnd(const char *name, const char *category, quint64 id);
+
+private:
+    Q_DISABLE_COPY(AalTracer)
+
+    void writeEvent(char phase, const char *name, const char *category, double timestamp,
+                    const QByteArray &extra = QByteArray());
+
+    static const bool s_enabled;
+
+    QMutex m_mutex;
+    QFile m_file;
+    bool m_firstEvent;
+    QSet<quintptr> m_namedThreads;
+};
+
+// Traces the time until the end of the enclosing scope
+class AalTraceScope
+{
+public:
+    AalTraceScope(const char *name, const char *category)
+        : m_name(AalTracer::isEnabled() ? name : nullptr),
+          m_category(category),
+          m_start(m_name ? AalTracer::now() : 0)
+    {
+    }
+
+    ~AalTraceScope()
+    {
+        if (Q_UNLIKELY(m_name != nullptr))
+            AalTracer::instance()->complete(m_name, m_category, m_start, AalTracer::now() - m_start);
+    }
+
+private:
+    Q_DISABLE_COPY(AalTraceScope)
+
+    const char *m_name;
+    const char *m_category;
+    double m_start;
+};
+
+#define AAL_TRACE_SCOPE(name, category) \
+    AalTraceScope aalTraceScope(name, category)
+
+#define AAL_TRACE_INSTANT(name, category) \
+    do { \
+        if (Q_UNLIKELY(AalTracer::isEnabled())) \
+            AalTracer::instance()->instant(name, category); \
+    } while (0)
+
+#define AAL_TRACE_INSTANT_ARG(name, category, argName, arg) \
+    do { \
+        if (Q_UNLIKELY(AalTracer::isEnabled())) \
+            AalTracer::instance()->instant(name, category, argName, arg); \
+    } while (0)
+
+#define AAL_TRACE_ASYNC_BEGIN(name, category, id) \
+    do { \
+        if (Q_UNLIKELY(AalTracer::isEnabled())) \
+            AalTracer::instance()->asyncBegin(name, category, id); \
+    } while (0)
+
+#define AAL_TRACE_ASYNC_END(name, category, id) \
+    do { \
+        if (Q_UNLIKELY(AalTracer::isEnabled())) \
+            AalTracer::instance()->asyncEnd(name, category, id); \
+    } while (0)
+
+#endif // AALTRACER_H
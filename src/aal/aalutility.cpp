@@ -15,6 +15,7 @@
  */
 
 #include "aalutility.h"
+#include "aallogging.h"
 
 #include <QDebug>
 
@@ -28,13 +29,13 @@ QUrl AalUtility::unescape(const QMediaContent &media)
 
     if (media.canonicalUrl().isLocalFile()) {
 #ifdef VERBOSE_DEBUG
-        qDebug() << "Local file URI: " << QUrl::fromPercentEncoding(media.canonicalUrl().toString().toUtf8());
+        qCDebug(aalPlayer) << "Local file URI: " << QUrl::fromPercentEncoding(media.canonicalUrl().toString().toUtf8());
 #endif
         return QUrl::fromPercentEncoding(media.canonicalUrl().toString().toUtf8());
     }
     else {
 #ifdef VERBOSE_DEBUG
-        qDebug() << "Remote stream URI: " << QUrl::fromEncoded(media.canonicalUrl().toString().toUtf8());
+        qCDebug(aalPlayer) << "Remote stream URI: " << QUrl::fromEncoded(media.canonicalUrl().toString().toUtf8());
 #endif
         return QUrl::fromEncoded(media.canonicalUrl().toString().toUtf8());
     }
@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2013-2014 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "aalvideoframepool.h"
+#include "aallogging.h"
+#include "aalsharedsignalrouter.h"
+
+#include <QDebug>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+
+class AalMemoryVideoBuffer;
+class AalPooledTextureBuffer;
+
+// Recycled memory buffers. Buffers that are still referenced by a frame when
+// the owning AalVideoFramePool goes away free themselves on release.
+class AalVideoMemoryPool
+{
+public:
+    ~AalVideoMemoryPool();
+
+    AalMemoryVideoBuffer *take(int numBytes, int bytesPerLine);
+    void put(AalMemoryVideoBuffer *buffer);
+
+private:
+    QMutex m_mutex;
+    QList<AalMemoryVideoBuffer*> m_freeBuffers;
+};
+
+// Recycled texture buffers, like AalVideoMemoryPool. A buffer only wraps the
+// texture id, the texture itself belongs to qtvideo-node.
+class AalVideoTexturePool
+{
+public:
+    ~AalVideoTexturePool();
+
+    AalPooledTextureBuffer *take(GLuint textureId);
+    void put(AalPooledTextureBuffer *buffer);
+    void clear();
+
+private:
+    QMutex m_mutex;
+    QList<AalPooledTextureBuffer*> m_freeBuffers;
+};
+
+class AalPooledTextureBuffer : public AalGLTextureBuffer
+{
+public:
+    AalPooledTextureBuffer(const std::shared_ptr<AalVideoTexturePool> &pool, GLuint textureId) :
+        AalGLTextureBuffer(textureId),
+        m_pool(pool)
+    {
+    }
+
+    // Called by QVideoFrame once the last copy of the frame is gone
+    void release()
+    {
+        const std::shared_ptr<AalVideoTexturePool> pool = m_pool.lock();
+        if (pool)
+            pool->put(this);
+        else
+            delete this;
+    }
+
+private:
+    std::weak_ptr<AalVideoTexturePool> m_pool;
+};
+
+class AalMemoryVideoBuffer : public QAbstractVideoBuffer
+{
+public:
+    AalMemoryVideoBuffer(const std::shared_ptr<AalVideoMemoryPool> &pool,
+                         int numBytes, int bytesPerLine) :
+        QAbstractVideoBuffer(QAbstractVideoBuffer::NoHandle),
+        m_pool(pool),
+        m_data(numBytes, Qt::Uninitialized),
+        m_bytesPerLine(bytesPerLine),
+        m_mapMode(NotMapped)
+    {
+    }
+
+    MapMode mapMode() const { return m_mapMode; }
+
+    uchar *map(MapMode mode, int *numBytes, int *bytesPerLine)
+    {
+        if (m_mapMode != NotMapped || mode == NotMapped)
+            return NULL;
+
+        m_mapMode = mode;
+        if (numBytes)
+            *numBytes = m_data.size();
+        if (bytesPerLine)
+            *bytesPerLine = m_bytesPerLine;
+
+        return bits();
+    }
+
+    void unmap()
+    {
+        m_mapMode = NotMapped;
+    }
+
+    // Called by QVideoFrame once the last copy of the frame is gone
+    void release()
+    {
+        m_mapMode = NotMapped;
+
+        const std::shared_ptr<AalVideoMemoryPool> pool = m_pool.lock();
+        if (pool)
+            pool->put(this);
+        else
+            delete this;
+    }
+
+    uchar *bits() { return reinterpret_cast<uchar*>(m_data.data()); }
+    int numBytes() const { return m_data.size(); }
+    int bytesPerLine() const { return m_bytesPerLine; }
+
+private:
+    std::weak_ptr<AalVideoMemoryPool> m_pool;
+    QByteArray m_data;
+    int m_bytesPerLine;
+    MapMode m_mapMode;
+};
+
+AalVideoMemoryPool::~AalVideoMemoryPool()
+{
+    qDeleteAll(m_freeBuffers);
+}
+
+AalMemoryVideoBuffer *AalVideoMemoryPool::take(int numBytes, int bytesPerLine)
+{
+    QMutexLocker locker(&m_mutex);
+
+    while (!m_freeBuffers.isEmpty()) {
+        AalMemoryVideoBuffer *buffer = m_freeBuffers.takeLast();
+        if (buffer->numBytes() == numBytes && buffer->bytesPerLine() == bytesPerLine)
+            return buffer;
+
+        // Left over from before a size or format change
+        delete buffer;
+    }
+
+    return nullptr;
+}
+
+void AalVideoMemoryPool::put(AalMemoryVideoBuffer *buffer)
+{
+    QMutexLocker locker(&m_mutex);
+    m_freeBuffers.append(buffer);
+}
+
+AalVideoTexturePool::~AalVideoTexturePool()
+{
+    qDeleteAll(m_freeBuffers);
+}
+
+AalPooledTextureBuffer *AalVideoTexturePool::take(GLuint textureId)
+{
+    QMutexLocker locker(&m_mutex);
+
+    while (!m_freeBuffers.isEmpty()) {
+        AalPooledTextureBuffer *buffer = m_freeBuffers.takeLast();
+        if (buffer->textureId() == textureId)
+            return buffer;
+
+        // Left over from a previous texture
+        delete buffer;
+    }
+
+    return nullptr;
+}
+
+void AalVideoTexturePool::put(AalPooledTextureBuffer *buffer)
+{
+    QMutexLocker locker(&m_mutex);
+    m_freeBuffers.append(buffer);
+}
+
+void AalVideoTexturePool::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    qDeleteAll(m_freeBuffers);
+    m_freeBuffers.clear();
+}
+
+namespace
+{
+int mappedFrameBytes(const QSize &size, QVideoFrame::PixelFormat format, int *bytesPerLine)
+{
+    switch (format)
+    {
+        case QVideoFrame::Format_RGB32:
+        case QVideoFrame::Format_ARGB32:
+            *bytesPerLine = size.width() * 4;
+            return *bytesPerLine * size.height();
+        case QVideoFrame::Format_NV12:
+            // Full size Y plane followed by an interleaved, half size UV plane
+            *bytesPerLine = size.width();
+            return size.width() * size.height() * 3 / 2;
+        default:
+            *bytesPerLine = 0;
+            return 0;
+    }
+}
+}
+
+AalGLTextureBuffer::AalGLTextureBuffer(GLuint textureId, quint64 routerToken) :
+    QAbstractVideoBuffer(QAbstractVideoBuffer::GLTextureHandle),
+    m_textureId(textureId),
+    m_routerToken(routerToken)
+{
+}
+
+uchar *AalGLTextureBuffer::map(MapMode mode, int *numBytes, int *bytesPerLine)
+{
+    qCDebug(aalRenderer) << Q_FUNC_INFO;
+    Q_UNUSED(mode);
+    Q_UNUSED(numBytes);
+    Q_UNUSED(bytesPerLine);
+
+    return NULL;
+}
+
+void AalGLTextureBuffer::unmap()
+{
+    qCDebug(aalRenderer) << Q_FUNC_INFO;
+}
+
+QVariant AalGLTextureBuffer::handle() const
+{
+    // qtvideo-node reads the handle of the frame it is about to answer
+    if (m_routerToken != 0)
+        AalSharedSignalRouter::noteHandshakeFrame(m_routerToken);
+
+    return QVariant::fromValue<unsigned int>(m_textureId);
+}
+
+AalVideoFramePool::AalVideoFramePool()
+    : m_memoryPool(std::make_shared<AalVideoMemoryPool>()),
+      m_texturePool(std::make_shared<AalVideoTexturePool>()),
+      m_allocations(0)
+{
+}
+
+QVideoFrame AalVideoFramePool::textureFrame(GLuint textureId, const QSize &size)
+{
+    AalPooledTextureBuffer *buffer = m_texturePool->take(textureId);
+    if (buffer == nullptr) {
+        buffer = new AalPooledTextureBuffer(m_texturePool, textureId);
+        ++m_allocations;
+    }
+
+    return QVideoFrame(buffer, size, QVideoFrame::Format_RGB32);
+}
+
+QVideoFrame AalVideoFramePool::mappedFrame(const QSize &size, QVideoFrame::PixelFormat format,
+                                           AalMappableFrameSource *source)
+{
+    int bytesPerLine = 0;
+    const int numBytes = mappedFrameBytes(size, format, &bytesPerLine);
+    if (numBytes <= 0 || source == nullptr)
+        return QVideoFrame();
+
+    AalMemoryVideoBuffer *buffer = m_memoryPool->take(numBytes, bytesPerLine);
+    if (buffer == nullptr) {
+        buffer = new AalMemoryVideoBuffer(m_memoryPool, numBytes, bytesPerLine);
+        ++m_allocations;
+    }
+
+    if (!source->readFrame(buffer->bits(), bytesPerLine, size, format)) {
+        buffer->release();
+        return QVideoFrame();
+    }
+
+    return QVideoFrame(buffer, size, format);
+}
+
+QList<QVideoFrame::PixelFormat> AalVideoFramePool::mappableFormats()
+{
+    return QList<QVideoFrame::PixelFormat>() << QVideoFrame::Format_RGB32
+                                             << QVideoFrame::Format_ARGB32
+                                             << QVideoFrame::Format_NV12;
+}
+
+void AalVideoFramePool::clear()
+{
+    // Buffers still held by frames are dropped when they come back, as
+    // they won't match the next texture
+    m_texturePool->clear();
+}
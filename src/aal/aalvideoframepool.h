@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2013-2014 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AALVIDEOFRAMEPOOL_H
+#define AALVIDEOFRAMEPOOL_H
+
+#include <QAbstractVideoBuffer>
+#include <QSize>
+#include <QVideoFrame>
+
+#include <memory>
+
+// Avoids a clash between Qt5's opengl headers and the platform GLES
+// headers
+typedef unsigned int GLuint;
+
+class AalGLTextureBuffer : public QAbstractVideoBuffer
+{
+public:
+    // Frames of the texture handshake carry the renderer's router token, see
+    // AalSharedSignalRouter
+    AalGLTextureBuffer(GLuint textureId, quint64 routerToken = 0);
+
+    MapMode mapMode() const { return NotMapped; }
+    uchar *map(MapMode mode, int *numBytes, int *bytesPerLine);
+    void unmap();
+
+    QVariant handle() const;
+
+    GLuint textureId() { return m_textureId; }
+
+private:
+    GLuint m_textureId;
+    quint64 m_routerToken;
+};
+
+// Implemented by video sinks that are able to write the current frame into
+// CPU memory. media-hub's GL texture sink can't, so frames are only mapped
+// for sinks that provide this (software decoders, GPU-less test sinks).
+class AalMappableFrameSource
+{
+public:
+    virtual ~AalMappableFrameSource() {}
+
+    // Fill bits, laid out as format with bytesPerLine, with the current frame
+    virtual bool readFrame(uchar *bits, int bytesPerLine, const QSize &size,
+                           QVideoFrame::PixelFormat format) = 0;
+};
+
+class AalVideoMemoryPool;
+class AalVideoTexturePool;
+
+// Hands out the QVideoFrames presented by the renderer. Every frame is a
+// frame of its own, so metadata and timestamps set on one never show up on
+// a frame the surface still holds. Only the buffers behind them are
+// recycled, so steady-state playback doesn't build any.
+class AalVideoFramePool
+{
+public:
+    AalVideoFramePool();
+
+    // A frame for textureId. Its buffer comes back to the pool once every
+    // copy of the frame is gone.
+    QVideoFrame textureFrame(GLuint textureId, const QSize &size);
+
+    // A CPU readable frame filled by source. Its memory comes back to the
+    // pool once every copy of the frame is gone, and mapping it hands the
+    // consumer that memory directly.
+    QVideoFrame mappedFrame(const QSize &size, QVideoFrame::PixelFormat format,
+                            AalMappableFrameSource *source);
+
+    void clear();
+
+    // Number of buffers built so far, for measuring allocations per present
+    quint64 allocations() const { return m_allocations; }
+
+    // Pixel formats mappedFrame() can produce, in order of preference
+    static QList<QVideoFrame::PixelFormat> mappableFormats();
+
+private:
+    std::shared_ptr<AalVideoMemoryPool> m_memoryPool;
+    std::shared_ptr<AalVideoTexturePool> m_texturePool;
+    quint64 m_allocations;
+};
+
+#endif // AALVIDEOFRAMEPOOL_H
@@ -15,8 +15,11 @@
  */
 
 #include "aalvideorenderercontrol.h"
+#include "aallogging.h"
 #include "aalmediaplayercontrol.h"
 #include "aalmediaplayerservice.h"
+#include "aalsharedsignalrouter.h"
+#include "aaltracer.h"
 
 #include <qtubuntu_media_signals.h>
 
@@ -24,6 +27,7 @@
 #include <QAbstractVideoSurface>
 #include <QDebug>
 #include <QGuiApplication>
+#include <QMutexLocker>
 #include <QObject>
 #include <QTimer>
 #include <QUrl>
@@ -38,60 +42,46 @@
 
 #include <qgl.h>
 
+#include <chrono>
+
 namespace media = lomiri::MediaHub;
 using namespace std::placeholders;
 
-class AalGLTextureBuffer : public QAbstractVideoBuffer
+namespace {
+qint64 steadyClockNs()
 {
-public:
-    AalGLTextureBuffer(GLuint textureId) :
-        QAbstractVideoBuffer(QAbstractVideoBuffer::GLTextureHandle),
-        m_textureId(textureId)
-    {
-    }
-
-    MapMode mapMode() const { return NotMapped; }
-    uchar *map(MapMode mode, int *numBytes, int *bytesPerLine)
-    {
-        qDebug() << Q_FUNC_INFO;
-        Q_UNUSED(mode);
-        Q_UNUSED(numBytes);
-        Q_UNUSED(bytesPerLine);
-
-        return NULL;
-    }
-
-    void unmap()
-    {
-        qDebug() << Q_FUNC_INFO;
-    }
-
-    QVariant handle() const
-    {
-        return QVariant::fromValue<unsigned int>(m_textureId);
-    }
-
-    GLuint textureId() { return m_textureId; }
-
-private:
-    GLuint m_textureId;
-};
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}
 
 AalVideoRendererControl::AalVideoRendererControl(AalMediaPlayerService *service, QObject *parent)
    : QVideoRendererControl(parent),
      m_surface(0),
      m_service(service),
+     m_videoSink(nullptr),
      m_textureBuffer(0),
+     m_mappedFormat(QVideoFrame::Format_Invalid),
      m_textureId(0),
+     m_routerToken(0),
      m_orientation(media::Player::Orientation::Rotate0),
      m_height(0),
      m_width(0),
      m_autoPlay(false),
-     m_surfaceStarted(false),
-     m_flipped(false),
      m_doRendering(false),
+     m_visible(true),
+     m_framePending(false),
+     m_inBackground(false),
+     m_resumeRendering(false),
+     m_restoringVideo(false),
+     m_streamClockRunning(false),
+     m_streamPositionUs(-1),
+     m_streamPositionNs(0),
+     m_frameAvailableNs(0),
+     m_frameStreamTimeUs(-1),
      m_firstFrame(true),
-     m_secondFrame(false)
+     m_secondFrame(false),
+     m_awaitingFirstFrame(false)
 #ifdef MEASURE_PERFORMANCE
      , m_lastFrameRenderStart(0)
      , m_currentFrameRenderStart(0)
@@ -99,15 +89,17 @@ AalVideoRendererControl::AalVideoRendererControl(AalMediaPlayerService *service,
      , m_frameRenderAvg(0)
 #endif
 {
-    // Get notified when qtvideo-node creates a GL texture
-    connect(SharedSignal::instance(), SIGNAL(textureCreated(unsigned int)),
-            this, SLOT(onTextureCreated(unsigned int)));
-    connect(SharedSignal::instance(), SIGNAL(glConsumerSet()), this, SLOT(onGLConsumerSet()));
+    // Get notified when qtvideo-node creates a GL texture for this renderer
+    if (AalSharedSignalRouter *router = AalSharedSignalRouter::instance())
+        m_routerToken = router->registerRenderer(this);
     connect(m_service, SIGNAL(playbackComplete()), this, SLOT(playbackComplete()));
 }
 
 AalVideoRendererControl::~AalVideoRendererControl()
 {
+    if (AalSharedSignalRouter *router = AalSharedSignalRouter::instance())
+        router->unregisterRenderer(m_routerToken);
+
     if (m_textureBuffer) {
         GLuint textureId = m_textureBuffer->handle().toUInt();
         if (textureId > 0)
@@ -125,11 +117,44 @@ QAbstractVideoSurface *AalVideoRendererControl::surface() const
 void AalVideoRendererControl::setSurface(QAbstractVideoSurface *surface)
 {
     if (m_surface != surface) {
-        m_surface = surface;
+        {
+            QMutexLocker locker(&m_presentMutex);
+            m_surface = surface;
+            negotiateFrameFormat();
+        }
         Q_EMIT surfaceChanged(surface);
     }
 }
 
+bool AalVideoRendererControl::isVisible() const
+{
+    return m_visible;
+}
+
+void AalVideoRendererControl::setVisible(bool visible)
+{
+    bool presentPending = false;
+    {
+        QMutexLocker locker(&m_presentMutex);
+        if (m_visible == visible)
+            return;
+
+        m_visible = visible;
+        presentPending = visible && m_framePending;
+        m_framePending = false;
+    }
+
+    qCDebug(aalRenderer) << Q_FUNC_INFO << visible;
+    // Show the latest frame right away instead of waiting for the next one
+    if (presentPending)
+        updateVideoTexture();
+}
+
+quint64 AalVideoRendererControl::frameAllocations() const
+{
+    return m_framePool.allocations();
+}
+
 GLuint AalVideoRendererControl::textureId() const
 {
     return m_textureId;
@@ -152,56 +177,160 @@ void AalVideoRendererControl::autoPlay(bool doAutoPlay)
 
 void AalVideoRendererControl::playbackComplete()
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalRenderer) << Q_FUNC_INFO;
+    QMutexLocker locker(&m_presentMutex);
     // Make updateVideoTexture basically a no-op while this is set to false
     m_doRendering = false;
 
-    // Reset key member variables so that we can start playback of the same video
-    // another time if the user presses play again
+    // The texture and the sink are kept, so that replaying or looping the
+    // same video doesn't go through the qtvideo-node handshake again. See
+    // rearmVideoSink().
+}
+
+void AalVideoRendererControl::releaseVideoSink()
+{
+    qCDebug(aalRenderer) << Q_FUNC_INFO;
+    QMutexLocker locker(&m_presentMutex);
+    m_doRendering = false;
+
+    // Reset key member variables so that the next media negotiates a new
+    // texture with qtvideo-node
     m_firstFrame = true;
     m_secondFrame = false;
     m_textureId = 0;
+    m_framePool.clear();
+    if (AalSharedSignalRouter *router = AalSharedSignalRouter::instance())
+        router->cancelExpectations(m_routerToken);
+
+    if (m_videoSink) {
+        QObject::disconnect(m_videoSink, nullptr, this, nullptr);
+        m_videoSink = nullptr;
+    }
+}
+
+void AalVideoRendererControl::enterBackground()
+{
+    if (m_inBackground || !m_videoSink)
+        return;
+
+    qCDebug(aalRenderer) << Q_FUNC_INFO;
+    m_inBackground = true;
+    m_resumeRendering = m_doRendering;
+
+    // Gives the texture back to qtvideo-node, there is nothing to show it
+    // in anyway, and stops frame notifications
+    if (m_textureId > 0)
+        Q_EMIT SharedSignal::instance()->sinkReset();
+    releaseVideoSink();
+}
+
+void AalVideoRendererControl::leaveBackground()
+{
+    if (!m_inBackground)
+        return;
+
+    qCDebug(aalRenderer) << Q_FUNC_INFO;
+    m_inBackground = false;
+    if (!m_resumeRendering)
+        return;
+
+    // Playback went on meanwhile, so getting the sink back must not trigger
+    // the autoPlay of onGLConsumerSet(). Starting the texture handshake right
+    // away has the video back with the next decoded frame.
+    m_restoringVideo = m_mappedFormat == QVideoFrame::Format_Invalid;
+    setupSurface();
+}
+
+bool AalVideoRendererControl::rearmVideoSink()
+{
+    if (!m_videoSink)
+        return false;
+
+    qCDebug(aalRenderer) << Q_FUNC_INFO << "texture id:" << m_textureId;
+    QMutexLocker locker(&m_presentMutex);
+    // media-hub tears the sink down when the player stops, asking for one on
+    // the same texture again brings it back
+    m_videoSink = &m_service->createVideoSink(m_textureId);
+    connectVideoSink();
+    return true;
 }
 
 void AalVideoRendererControl::setupSurface()
 {
     media::Player *player = m_service->getPlayer().get();
     QObject::connect(player, &media::Player::videoDimensionChanged,
-                     this, &AalVideoRendererControl::onVideoDimensionChanged);
+                     this, &AalVideoRendererControl::onVideoDimensionChanged,
+                     Qt::UniqueConnection);
 
-    // When orientation changes during playback, cache a copy here
+    // Rotation may change during playback too, e.g. when recording with
+    // the phone turned
     QObject::connect(player, &media::Player::orientationChanged,
-                     this, [this, player]()
-    {
-        m_orientation = player->orientation();
-    });
+                     this, &AalVideoRendererControl::onOrientationChanged,
+                     Qt::UniqueConnection);
+
+    // Keeps the stream clock frames get stamped with
+    QObject::connect(player, &media::Player::positionChanged,
+                     this, &AalVideoRendererControl::onStreamPositionChanged,
+                     Qt::UniqueConnection);
+    QObject::connect(player, &media::Player::seekedTo,
+                     this, &AalVideoRendererControl::onStreamPositionChanged,
+                     Qt::UniqueConnection);
+    QObject::connect(player, &media::Player::playbackStatusChanged,
+                     this, &AalVideoRendererControl::onPlaybackStatusChanged,
+                     Qt::UniqueConnection);
 
     if (!m_textureBuffer)
         m_textureBuffer = new AalGLTextureBuffer(m_textureId);
 
-    // Enable rendering by enabling the logic in updateVideoTexture
-    m_doRendering = true;
+    {
+        QMutexLocker locker(&m_presentMutex);
+        // Surfaces without GL support don't go through qtvideo-node, so there is
+        // no texture to wait for and the sink is created right away
+        if (m_mappedFormat != QVideoFrame::Format_Invalid && !m_videoSink) {
+            if (!setupMappedVideoSink())
+                m_mappedFormat = QVideoFrame::Format_Invalid;
+        }
+
+        // Enable rendering by enabling the logic in updateVideoTexture
+        m_doRendering = true;
+
+        if (!m_awaitingFirstFrame) {
+            m_awaitingFirstFrame = true;
+            AAL_TRACE_ASYNC_BEGIN("firstFrame", "renderer", m_routerToken);
+        }
+    }
 
     updateVideoTexture();
 }
 
 void AalVideoRendererControl::onVideoDimensionChanged(const QSize &dimensions)
 {
-    qDebug() << Q_FUNC_INFO << dimensions;
-    QSize frameSize;
-
-    // Make sure that X & Y remain flipped between multiple playbacks in the
-    // same session
-    if ((m_orientation == media::Player::Orientation::Rotate90 ||
-         m_orientation == media::Player::Orientation::Rotate270) && !m_flipped) {
-        frameSize = dimensions.transposed();
-        m_flipped = true;
-    } else {
-        frameSize = dimensions;
-    }
+    qCDebug(aalRenderer) << Q_FUNC_INFO << dimensions;
+    // Adaptive streams change resolution mid-playback, each change is applied
+    // in place: the next presented frame restarts the surface with the new
+    // format while the sink and texture are kept
+    m_videoDimensions = dimensions;
+    updateFrameSize();
+}
 
-    m_width = frameSize.width();
-    m_height = frameSize.height();
+void AalVideoRendererControl::onOrientationChanged()
+{
+    m_orientation = m_service->getPlayer()->orientation();
+    if (m_videoDimensions.isValid())
+        updateFrameSize();
+}
+
+void AalVideoRendererControl::updateFrameSize()
+{
+    const bool rotated = m_orientation == media::Player::Orientation::Rotate90 ||
+            m_orientation == media::Player::Orientation::Rotate270;
+    const QSize frameSize = rotated ? m_videoDimensions.transposed() : m_videoDimensions;
+
+    {
+        QMutexLocker locker(&m_presentMutex);
+        m_width = frameSize.width();
+        m_height = frameSize.height();
+    }
     Q_EMIT SharedSignal::instance()->setOrientation(static_cast<SharedSignal::Orientation>(m_orientation), frameSize);
 }
 
@@ -210,25 +339,46 @@ void AalVideoRendererControl::onFrameAvailable()
 #ifdef MEASURE_PERFORMANCE
     s->measurePerformance();
 #endif
+    {
+        QMutexLocker locker(&m_presentMutex);
+        m_frameAvailableNs = steadyClockNs();
+        m_frameStreamTimeUs = streamTimeUs(m_frameAvailableNs);
+    }
+
     QMetaObject::invokeMethod(this, "updateVideoTexture", Qt::QueuedConnection);
 }
 
 void AalVideoRendererControl::updateVideoTexture()
 {
+    QMutexLocker locker(&m_presentMutex);
+
     // Only render frames when explicitly desired
     if (!m_doRendering)
     {
-        qWarning() << "Rendering not enabled, returning without presenting frame";
+        // Expected while paused or in the background, i.e. once per frame
+        qCDebug(aalRenderer) << "Rendering not enabled, returning without presenting frame";
         return;
     }
 
     if (!m_surface) {
-        qWarning() << "m_surface is NULL, can't update video texture" << endl;
+        qCWarning(aalRenderer) << "m_surface is NULL, can't update video texture";
         return;
     }
 
     if (!m_textureBuffer) {
-        qWarning() << "m_textureBuffer is NULL, can't update video texture" << endl;
+        qCWarning(aalRenderer) << "m_textureBuffer is NULL, can't update video texture";
+        return;
+    }
+
+    // Only the texture handshake goes on while the video can't be seen,
+    // setVisible(true) presents the latest frame
+    if (!m_visible && !inTextureHandshake()) {
+        m_framePending = true;
+        return;
+    }
+
+    if (m_mappedFormat != QVideoFrame::Format_Invalid) {
+        presentMappedFrame();
         return;
     }
 
@@ -236,13 +386,18 @@ void AalVideoRendererControl::updateVideoTexture()
     // This is necessary so that a ShaderVideoNode instance from qtvideo-node gets created,
     // as it is responsible for creating and returning a new texture and ID respectively.
     if (m_textureId == 0 && !m_firstFrame) {
-        qWarning() << "m_textureId == 0, can't update video texture" << endl;
+        qCWarning(aalRenderer) << "m_textureId == 0, can't update video texture";
         return;
     }
 
-    QVideoFrame frame(new AalGLTextureBuffer(m_textureId), QSize(m_width, m_height), QVideoFrame::Format_RGB32);
+    // The handshake frames tell the router which renderer qtvideo-node is
+    // answering, see AalSharedSignalRouter
+    const QSize frameSize(m_width, m_height);
+    QVideoFrame frame = inTextureHandshake()
+            ? QVideoFrame(new AalGLTextureBuffer(m_textureId, m_routerToken), frameSize, QVideoFrame::Format_RGB32)
+            : m_framePool.textureFrame(m_textureId, frameSize);
     if (!frame.isValid()) {
-        qWarning() << "Frame is invalid, not presenting." << endl;
+        qCWarning(aalRenderer) << "Frame is invalid, not presenting.";
         return;
     }
 
@@ -251,10 +406,77 @@ void AalVideoRendererControl::updateVideoTexture()
         // Sending an empty frame triggers qtvideo-node to generate a texture id
         m_firstFrame = false;
         m_secondFrame = true;
+        if (AalSharedSignalRouter *router = AalSharedSignalRouter::instance())
+            router->expectTexture(m_routerToken);
+        AAL_TRACE_ASYNC_BEGIN("textureHandshake", "renderer", m_routerToken);
     }
     else if (m_secondFrame) {
         frame.setMetaData("GLVideoSink", QVariant::fromValue(m_videoSink));
         m_secondFrame = false;
+        if (AalSharedSignalRouter *router = AalSharedSignalRouter::instance())
+            router->expectGLConsumer(m_routerToken);
+    }
+
+    presentVideoFrame(frame);
+}
+
+void AalVideoRendererControl::negotiateFrameFormat()
+{
+    m_mappedFormat = QVideoFrame::Format_Invalid;
+
+    // GL textures are always preferred, they don't need any copying at all
+    if (!m_surface || m_surface->supportedPixelFormats(QAbstractVideoBuffer::GLTextureHandle)
+            .contains(QVideoFrame::Format_RGB32))
+        return;
+
+    const QList<QVideoFrame::PixelFormat> formats =
+            m_surface->supportedPixelFormats(QAbstractVideoBuffer::NoHandle);
+    Q_FOREACH(QVideoFrame::PixelFormat format, AalVideoFramePool::mappableFormats()) {
+        if (formats.contains(format)) {
+            qCDebug(aalRenderer) << "Surface has no GL texture support, using mapped frames of format" << format;
+            m_mappedFormat = format;
+            return;
+        }
+    }
+}
+
+bool AalVideoRendererControl::setupMappedVideoSink()
+{
+    // A sink, once created, counts as the video output, so don't create one
+    // that would be of no use
+    if (!m_service->canMapVideoFrames()) {
+        qCWarning(aalRenderer) << "Video sinks can't provide CPU frames, falling back to GL textures";
+        return false;
+    }
+
+    media::VideoSink &sink = m_service->createVideoSink(0);
+    if (!dynamic_cast<AalMappableFrameSource*>(&sink)) {
+        qCWarning(aalRenderer) << "Video sink can't provide CPU frames although the player said so";
+        return false;
+    }
+
+    m_videoSink = &sink;
+    connectVideoSink();
+    return true;
+}
+
+void AalVideoRendererControl::connectVideoSink()
+{
+    QObject::connect(m_videoSink, &media::VideoSink::frameAvailable,
+                     this, &AalVideoRendererControl::onFrameAvailable,
+                     Qt::UniqueConnection);
+}
+
+void AalVideoRendererControl::presentMappedFrame()
+{
+    AalMappableFrameSource *source = dynamic_cast<AalMappableFrameSource*>(m_videoSink);
+    if (!source || m_width == 0 || m_height == 0)
+        return;
+
+    const QVideoFrame frame = m_framePool.mappedFrame(QSize(m_width, m_height), m_mappedFormat, source);
+    if (!frame.isValid()) {
+        qCWarning(aalRenderer) << "Failed to read a CPU frame from the video sink, not presenting.";
+        return;
     }
 
     presentVideoFrame(frame);
@@ -262,52 +484,61 @@ void AalVideoRendererControl::updateVideoTexture()
 
 void AalVideoRendererControl::onTextureCreated(unsigned int textureID)
 {
-    if (m_textureId == 0) {
-        m_textureId = static_cast<GLuint>(textureID);
-        // Remove old instance first (assignment first creates the new object,
-        // then removes the old one, but we need the resources from the old
-        // object to create the new one, so we force the right order with an
-        // initial pointer reset).
-        m_videoSink = &m_service->createVideoSink(textureID);
+    AAL_TRACE_SCOPE("onTextureCreated", "renderer");
+
+    // Mapped frames are read straight from the sink, no texture involved
+    if (m_mappedFormat != QVideoFrame::Format_Invalid)
+        return;
 
-        // Connect callback so that frames are rendered after decoding
-        QObject::connect(m_videoSink, &media::VideoSink::frameAvailable,
-                         this, &AalVideoRendererControl::onFrameAvailable);
+    if (m_textureId == 0) {
+        {
+            QMutexLocker locker(&m_presentMutex);
+            m_textureId = static_cast<GLuint>(textureID);
+            // Remove old instance first (assignment first creates the new object,
+            // then removes the old one, but we need the resources from the old
+            // object to create the new one, so we force the right order with an
+            // initial pointer reset).
+            m_videoSink = &m_service->createVideoSink(textureID);
+
+            // Connect callback so that frames are rendered after decoding
+            connectVideoSink();
+        }
 
         // This call will make sure the video sink gets set on qtvideo-node
         updateVideoTexture();
     }
     else
-        qDebug() << "Already have a texture id and video sink, not creating a new one";
+        qCDebug(aalRenderer) << "Already have a texture id and video sink, not creating a new one";
 }
 
 void AalVideoRendererControl::onGLConsumerSet()
 {
-    qDebug() << Q_FUNC_INFO;
+    qCDebug(aalRenderer) << Q_FUNC_INFO;
+    AAL_TRACE_ASYNC_END("textureHandshake", "renderer", m_routerToken);
+    if (m_restoringVideo) {
+        m_restoringVideo = false;
+        return;
+    }
+
     // Only cause playback to start if QMediaPlayerControl::play() was already called.
     // See AalMediaPlayerService::play()
     if (m_autoPlay)
         m_service->play();
 }
 
-void AalVideoRendererControl::presentVideoFrame(const QVideoFrame &frame, bool empty)
+void AalVideoRendererControl::presentVideoFrame(QVideoFrame frame, bool empty)
 {
     Q_UNUSED(empty);
     Q_ASSERT(m_surface != NULL);
 
-    // Wait until we have a height and width to start m_surface
-    if (!m_surface->isActive() || (m_height != 0 && m_width != 0)) {
-        if (!m_surfaceStarted) {
-            qDebug() << "Setting up surface with height: " << m_height << " width: " << m_width;
-            QVideoSurfaceFormat format(frame.size(), frame.pixelFormat(), frame.handleType());
-
-            if (!m_surface->start(format)) {
-                qWarning() << "Failed to start video surface with format:" << format;
-            }
-            // Make sure we don't create any more new QVideoSurfaceFormat instances
-            // after we have a proper height and width set
-            if (m_height != 0 && m_width != 0)
-                m_surfaceStarted = true;
+    if (needsSurfaceFormat(frame)) {
+        qCDebug(aalRenderer) << "Setting up surface with height: " << m_height << " width: " << m_width;
+        QVideoSurfaceFormat format(frame.size(), frame.pixelFormat(), frame.handleType());
+
+        // An active surface is restarted without stopping it first, stopping
+        // would make qtvideo-node drop its node along with our texture
+        if (!m_surface->start(format)) {
+            qCWarning(aalRenderer) << "Failed to start video surface with format:" << format;
         }
     }
 
@@ -319,15 +550,15 @@ void AalVideoRendererControl::presentVideoFrame(const QVideoFrame &frame, bool e
         if (delta > 0)
         {
             m_frameRenderAvg += delta;
-            qDebug() << "-------------------------------------------------------------------";
-            qDebug() << "Frame-to-frame delta (ms): " << delta << "(thread id: " << QThread::currentThreadId() << ")";
+            qCDebug(aalRenderer) << "-------------------------------------------------------------------";
+            qCDebug(aalRenderer) << "Frame-to-frame delta (ms): " << delta << "(thread id: " << QThread::currentThreadId() << ")";
         }
     }
 
     if (m_avgCount == 30) {
         // Ideally if playing a video that was recorded at 30 fps, the average for
         // playback should be close to 30 fps too
-        qDebug() << "Frame-to-frame average (ms) (30 frames times counted): " << (m_frameRenderAvg / 30);
+        qCDebug(aalRenderer) << "Frame-to-frame average (ms) (30 frames times counted): " << (m_frameRenderAvg / 30);
         m_avgCount = m_frameRenderAvg = 0;
     }
     else
@@ -335,6 +566,97 @@ void AalVideoRendererControl::presentVideoFrame(const QVideoFrame &frame, bool e
 #endif
 
     if (m_surface->isActive()) {
+        stampFrame(frame);
         m_surface->present(frame);
     }
 }
+
+bool AalVideoRendererControl::inTextureHandshake() const
+{
+    return m_mappedFormat == QVideoFrame::Format_Invalid && (m_firstFrame || m_secondFrame);
+}
+
+bool AalVideoRendererControl::needsSurfaceFormat(const QVideoFrame &frame) const
+{
+    if (!m_surface->isActive())
+        return true;
+
+    // The empty frame of the texture handshake doesn't know its size yet,
+    // the surface keeps whatever it was started with until one is known
+    if (m_height == 0 || m_width == 0)
+        return false;
+
+    const QVideoSurfaceFormat format = m_surface->surfaceFormat();
+    return format.frameSize() != frame.size()
+            || format.pixelFormat() != frame.pixelFormat()
+            || format.handleType() != frame.handleType();
+}
+
+AalFrameTimingStats AalVideoRendererControl::frameTimingStats() const
+{
+    QMutexLocker locker(&m_presentMutex);
+    return m_frameTimingStats;
+}
+
+void AalVideoRendererControl::resetFrameTimingStats()
+{
+    QMutexLocker locker(&m_presentMutex);
+    m_frameTimingStats = AalFrameTimingStats();
+}
+
+void AalVideoRendererControl::onStreamPositionChanged(quint64 microseconds)
+{
+    QMutexLocker locker(&m_presentMutex);
+    m_streamPositionUs = microseconds;
+    m_streamPositionNs = steadyClockNs();
+}
+
+void AalVideoRendererControl::onPlaybackStatusChanged()
+{
+    const bool running = m_service->getPlayer()->playbackStatus() == media::Player::PlaybackStatus::Playing;
+
+    QMutexLocker locker(&m_presentMutex);
+    // Restart interpolating from where the clock stopped
+    const qint64 nowNs = steadyClockNs();
+    m_streamPositionUs = streamTimeUs(nowNs);
+    m_streamPositionNs = nowNs;
+    m_streamClockRunning = running;
+}
+
+qint64 AalVideoRendererControl::streamTimeUs(qint64 steadyNs) const
+{
+    if (m_streamPositionUs < 0)
+        return -1;
+
+    // media-hub only reports the position now and then, it's interpolated
+    // in between while playing
+    if (!m_streamClockRunning)
+        return m_streamPositionUs;
+
+    return m_streamPositionUs + (steadyNs - m_streamPositionNs) / 1000;
+}
+
+void AalVideoRendererControl::stampFrame(QVideoFrame &frame)
+{
+    m_service->flightRecorder().record(AalFlightRecorder::FramePresented, m_frameStreamTimeUs);
+    if (m_awaitingFirstFrame) {
+        m_awaitingFirstFrame = false;
+        AAL_TRACE_ASYNC_END("firstFrame", "renderer", m_routerToken);
+    }
+
+    // QVideoFrame copies share their metadata, which is why frames are
+    // never reused once presented, see AalVideoFramePool
+    frame.setMetaData(QStringLiteral("AvailableTime"), m_frameAvailableNs);
+    if (m_frameStreamTimeUs < 0)
+        return;
+
+    frame.setStartTime(m_frameStreamTimeUs);
+
+    // How far the stream clock moved on between the frame becoming available
+    // and it being presented, i.e. how late it is compared to the audio
+    const qint64 driftUs = streamTimeUs(steadyClockNs()) - m_frameStreamTimeUs;
+    ++m_frameTimingStats.frames;
+    m_frameTimingStats.lastDriftUs = driftUs;
+    m_frameTimingStats.maxDriftUs = qMax(m_frameTimingStats.maxDriftUs, driftUs);
+    m_frameTimingStats.totalDriftUs += driftUs;
+}
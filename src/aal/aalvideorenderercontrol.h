@@ -17,10 +17,13 @@
 #ifndef AALVIDEORENDERERCONTROL_H
 #define AALVIDEORENDERERCONTROL_H
 
+#include "aalvideoframepool.h"
+
 #include <MediaHub/Player>
 #include <MediaHub/VideoSink>
 
 #include <QImage>
+#include <QMutex>
 #include <QVideoFrame>
 #include <QVideoRendererControl>
 
@@ -29,17 +32,24 @@
 //#define MEASURE_PERFORMANCE
 
 class AalMediaPlayerService;
-class AalGLTextureBuffer;
 
-// Avoids a clash between Qt5's opengl headers and the platform GLES
-// headers
-typedef unsigned int GLuint;
+// Lateness of presented frames relative to the stream (audio) clock
+struct AalFrameTimingStats
+{
+    quint64 frames = 0;
+    qint64 lastDriftUs = 0;
+    qint64 maxDriftUs = 0;
+    qint64 totalDriftUs = 0;
+
+    qint64 averageDriftUs() const { return frames ? totalDriftUs / qint64(frames) : 0; }
+};
 
 class AalVideoRendererControl : public QVideoRendererControl
 {
     Q_OBJECT
 
     friend class AalMediaPlayerService;
+    friend class AalSharedSignalRouter;
 
 public:
     AalVideoRendererControl(AalMediaPlayerService *service, QObject *parent = 0);
@@ -50,6 +60,18 @@ public:
 
     GLuint textureId() const;
 
+    // Number of frame buffers built so far, see AalVideoFramePool. Stays
+    // constant while buffers of the same texture and size are recycled.
+    // Each present still allocates the QVideoFrame itself and the metadata
+    // stampFrame() sets on it, which this doesn't count.
+    quint64 frameAllocations() const;
+
+    // Presented frames carry the stream time they became available at as
+    // their start time (microseconds) and the steady clock time they became
+    // available at as "AvailableTime" meta data (nanoseconds)
+    AalFrameTimingStats frameTimingStats() const;
+    void resetFrameTimingStats();
+
     uint32_t height() const;
     uint32_t width() const;
 
@@ -59,7 +81,26 @@ public:
     // Callbacks
     static void updateVideoTextureCb(void *context);
 
+    // Gives the texture back to qtvideo-node and forgets the sink, for when
+    // different media gets loaded
+    void releaseVideoSink();
+    // Asks media-hub for the sink of the texture kept since the last
+    // playback. Returns false if there was none.
+    bool rearmVideoSink();
+
+    // While the application is in the background no frames are delivered
+    // and the texture is given back. Leaving the background brings the
+    // video back the way it was.
+    void enterBackground();
+    void leaveBackground();
+
+    bool isVisible() const;
+
 public Q_SLOTS:
+    // While not visible, e.g. scrolled out of view or covered by another
+    // page, frames are dropped instead of presented. Audio keeps playing.
+    void setVisible(bool visible);
+
     void setupSurface();
     void playbackComplete();
 
@@ -73,25 +114,72 @@ private Q_SLOTS:
 
 private:
     void onVideoDimensionChanged(const QSize &dimensions);
+    void onOrientationChanged();
+    void onStreamPositionChanged(quint64 microseconds);
+    void onPlaybackStatusChanged();
+    // Current stream position, -1 until media-hub reported one. Expects
+    // m_presentMutex to be held, like stampFrame().
+    qint64 streamTimeUs(qint64 steadyNs) const;
+    // Sets the frame's timing. Only for frames fresh from m_framePool, which
+    // nobody else holds.
+    void stampFrame(QVideoFrame &frame);
+    // Updates m_width/m_height from the decoded dimensions and orientation
+    void updateFrameSize();
     void onFrameAvailable();
-    void presentVideoFrame(const QVideoFrame &frame, bool empty = false);
+    void connectVideoSink();
+    void presentVideoFrame(QVideoFrame frame, bool empty = false);
+    // Whether the surface has to be (re)started to take this frame
+    bool needsSurfaceFormat(const QVideoFrame &frame) const;
+    // Whether the next frame is part of getting a texture from qtvideo-node
+    bool inTextureHandshake() const;
+
+    // Picks CPU mapped frames for surfaces that can't take GL textures
+    void negotiateFrameFormat();
+    bool setupMappedVideoSink();
+    void presentMappedFrame();
 
     QAbstractVideoSurface *m_surface;
     AalMediaPlayerService *m_service;
     lomiri::MediaHub::VideoSink *m_videoSink;
     AalGLTextureBuffer *m_textureBuffer;
+    AalVideoFramePool m_framePool;
+    // Format_Invalid unless the surface gets CPU mapped frames
+    QVideoFrame::PixelFormat m_mappedFormat;
     GLuint m_textureId;
+    // Addresses SharedSignal events to this renderer
+    quint64 m_routerToken;
 
     lomiri::MediaHub::Player::Orientation m_orientation;
+    // As reported by media-hub, before applying m_orientation
+    QSize m_videoDimensions;
     uint32_t m_height;
     uint32_t m_width;
     bool m_autoPlay;
-    bool m_surfaceStarted;
-    bool m_flipped;
     bool m_doRendering;
+    bool m_visible;
+    // A frame was dropped while not visible
+    bool m_framePending;
+    bool m_inBackground;
+    bool m_resumeRendering;
+    // The texture handshake was restarted by leaveBackground()
+    bool m_restoringVideo;
+    // Guards the presentation state and the frame timing, which
+    // frameTimingStats() may be asked for from any thread
+    mutable QMutex m_presentMutex;
+
+    // Stream position last reported by media-hub and the steady clock time
+    // it was reported at
+    bool m_streamClockRunning;
+    qint64 m_streamPositionUs;
+    qint64 m_streamPositionNs;
+    qint64 m_frameAvailableNs;
+    qint64 m_frameStreamTimeUs;
+    AalFrameTimingStats m_frameTimingStats;
 
     bool m_firstFrame;
     bool m_secondFrame;
+    // For tracing the time from setupSurface() to the first frame shown
+    bool m_awaitingFirstFrame;
 
 #ifdef MEASURE_PERFORMANCE
     qint64 m_lastFrameRenderStart;
@@ -10,9 +10,11 @@ QT += qml quick quick core qml multimedia multimedia
 QMAKE_CXXFLAGS += -std=c++11
 
 SOURCES = plugin.cpp \
-          qubuntumedia.cpp
+          qubuntumedia.cpp \
+          playlistsnapshot.cpp
 
 HEADERS = qubuntumedia.h \
+          playlistsnapshot.h \
           logging.h
 
 target.files += libubuntumediaplugin.so qmldir
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2014 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "playlistsnapshot.h"
+#include "logging.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+PlaylistSnapshot::PlaylistSnapshot()
+    : currentIndex(0),
+      position(0),
+      playbackMode(0)
+{
+}
+
+bool PlaylistSnapshot::save(const QString &path) const
+{
+    // Write to a temporary file first so a crash never leaves a truncated snapshot
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to open playlist snapshot for writing:" << path;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << Magic << Version
+        << qint32(currentIndex) << qint64(position) << qint32(playbackMode)
+        << quint32(urls.size());
+    Q_FOREACH(const QUrl &url, urls) {
+        out << url.toEncoded();
+    }
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "Failed to write playlist snapshot:" << path;
+        return false;
+    }
+
+    DLOG("Saved playlist snapshot of %d tracks", urls.size());
+    return true;
+}
+
+bool PlaylistSnapshot::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open playlist snapshot for reading:" << path;
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    in >> magic >> version;
+    if (magic != Magic || version != Version) {
+        qWarning() << "Unsupported playlist snapshot format:" << path;
+        return false;
+    }
+
+    qint32 index = 0, mode = 0;
+    qint64 pos = 0;
+    quint32 count = 0;
+    in >> index >> pos >> mode >> count;
+
+    QList<QUrl> loadedUrls;
+    // Don't trust the header blindly, a corrupt count shouldn't exhaust memory
+    loadedUrls.reserve(qMin<quint32>(count, file.size() / sizeof(quint32)));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QByteArray encoded;
+        in >> encoded;
+        loadedUrls.append(QUrl::fromEncoded(encoded));
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Playlist snapshot is truncated or corrupt:" << path;
+        return false;
+    }
+
+    urls = loadedUrls;
+    currentIndex = index;
+    position = pos;
+    playbackMode = mode;
+
+    DLOG("Loaded playlist snapshot of %d tracks", urls.size());
+    return true;
+}
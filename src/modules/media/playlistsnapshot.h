@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2014 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PLAYLISTSNAPSHOT_H
+#define PLAYLISTSNAPSHOT_H
+
+#include <QList>
+#include <QString>
+#include <QUrl>
+
+// Compact on-disk image of a play queue, so that an app can get back to
+// playing at startup without re-adding every track individually.
+//
+// File layout (QDataStream, big endian):
+//   quint32 magic, quint16 version, qint32 currentIndex, qint64 position (ms),
+//   qint32 playbackMode, quint32 count, count x QByteArray (encoded URL)
+struct PlaylistSnapshot
+{
+    static const quint32 Magic = 0x51555053; // "QUPS"
+    static const quint16 Version = 1;
+
+    PlaylistSnapshot();
+
+    bool save(const QString &path) const;
+    bool load(const QString &path);
+
+    QList<QUrl> urls;
+    int currentIndex;
+    qint64 position;
+    int playbackMode;
+};
+
+#endif // PLAYLISTSNAPSHOT_H
@@ -17,11 +17,20 @@
  */
 
 #include "qubuntumedia.h"
+#include "playlistsnapshot.h"
+
+#include <QMediaPlaylistControl>
+#include <QMediaService>
+#include <QVideoRendererControl>
 
 QUbuntuMedia::QUbuntuMedia(QObject* parent)
     : QObject(parent),
       m_player(nullptr),
-      m_mediaPlaylist(new QMediaPlaylist())
+      m_mediaPlaylist(new QMediaPlaylist()),
+      m_videoVisible(true),
+      m_videoVisibleForwarded(false),
+      m_restoreIndex(-1),
+      m_restorePosition(0)
 {
 }
 
@@ -33,21 +42,278 @@ void QUbuntuMedia::setPlaylist(const QList<QUrl> &playlist, int index, PlaybackM
     if (m_qmlPlaylist == playlist)
         return;
 
+    connectLoadProgress();
+
+    const QList<QUrl> previous = m_qmlPlaylist;
     m_qmlPlaylist = playlist;
+    // The app has moved on from the restored queue
+    m_restoreIndex = -1;
+
+    if (playlist.empty()) {
+        if (!m_mediaPlaylist->isEmpty()) {
+            m_mediaPlaylist->clear();
+        }
+        return;
+    }
+
+    const bool firstLoad = m_mediaPlaylist->isEmpty();
+    const QUrl currentUrl = previous.value(m_mediaPlaylist->currentIndex());
+
+    if (firstLoad)
+        m_mediaPlaylist->addMedia(toMediaContents(playlist));
+    else
+        applyPlaylistEdits(previous, playlist);
+
+    // Don't restart the track that is already playing if the edit only moved it
+    if (firstLoad || playlist.value(index) != currentUrl)
+        m_mediaPlaylist->setCurrentIndex(index);
+
+    applyPlaybackMode(mode);
+
+    // FIXME: This is a hack, however there is currently no other way to get a Playlist to
+    // the media controls. Qt takes it upon itself to walk playlists, that breaks our
+    // out-of-process scenario.
+    if (firstLoad)
+        m_player->setMedia(0, reinterpret_cast<QIODevice*>(m_mediaPlaylist));
+
+    Q_EMIT playlistChanged();
+}
+
+void QUbuntuMedia::applyPlaylistEdits(const QList<QUrl> &from, const QList<QUrl> &to)
+{
+    // Leave the common head and tail of both lists alone; only the span in
+    // between needs to be touched on the media-hub side
+    int prefix = 0;
+    while (prefix < from.size() && prefix < to.size() && from[prefix] == to[prefix])
+        ++prefix;
+
+    int suffix = 0;
+    while (suffix < from.size() - prefix && suffix < to.size() - prefix
+           && from[from.size() - 1 - suffix] == to[to.size() - 1 - suffix])
+        ++suffix;
+
+    const int removed = from.size() - suffix - prefix;
+    const int inserted = to.size() - suffix - prefix;
+    const QList<QUrl> insertedUrls = to.mid(prefix, inserted);
+    // The backend applies edits asynchronously, so decide from the lists
+    // themselves whether the span reaches the end instead of mediaCount()
+    const bool atEnd = (suffix == 0);
+
+    DLOG("Playlist edit at %d: %d removed, %d inserted", prefix, removed, inserted);
+
+    if (removed == 0) {
+        insertMedia(prefix, insertedUrls, atEnd);
+        return;
+    }
+
+    if (inserted == 0) {
+        m_mediaPlaylist->removeMedia(prefix, prefix + removed - 1);
+        return;
+    }
+
+    // A single track dragged to a new position leaves everything else in the
+    // span in order, with the moved track at one of its ends
+    if (removed == inserted && removed > 1) {
+        const int last = prefix + removed - 1;
+        if (from[last] == to[prefix] && from.mid(prefix, removed - 1) == to.mid(prefix + 1, removed - 1)) {
+            m_mediaPlaylist->moveMedia(last, prefix);
+            return;
+        }
+        if (from[prefix] == to[last] && from.mid(prefix + 1, removed - 1) == to.mid(prefix, removed - 1)) {
+            m_mediaPlaylist->moveMedia(prefix, last);
+            return;
+        }
+    }
+
+    m_mediaPlaylist->removeMedia(prefix, prefix + removed - 1);
+    insertMedia(prefix, insertedUrls, atEnd);
+}
+
+void QUbuntuMedia::insertMedia(int index, const QList<QUrl> &urls, bool append)
+{
+    if (append)
+        m_mediaPlaylist->addMedia(toMediaContents(urls));
+    else
+        m_mediaPlaylist->insertMedia(index, toMediaContents(urls));
+}
+
+QList<QMediaContent> QUbuntuMedia::toMediaContents(const QList<QUrl> &urls)
+{
+    QList<QMediaContent> contents;
+    contents.reserve(urls.size());
+    Q_FOREACH(const QUrl& mediaUrl, urls) {
+        contents.append(QMediaContent(mediaUrl));
+    }
+    return contents;
+}
+
+void QUbuntuMedia::setMediaPlayer(QObject *mediaPlayer)
+{
+    if (mediaPlayer == m_player)
+        return;
+
+    if (m_player != nullptr)
+        disconnect(m_player, nullptr, this, nullptr);
+
+    m_player = qobject_cast<QMediaPlayer*>(mediaPlayer->property("mediaObject").value<QObject*>());
+    m_videoVisibleForwarded = false;
+    if (m_player != nullptr) {
+        connect(m_player, &QMediaPlayer::mediaStatusChanged, this, &QUbuntuMedia::onMediaStatusChanged);
+        connect(m_player, &QMediaPlayer::videoAvailableChanged, this, &QUbuntuMedia::onVideoAvailableChanged);
+    }
+    if (!m_videoVisible)
+        applyVideoVisible();
+}
+
+void QUbuntuMedia::setVideoVisible(bool visible)
+{
+    if (visible == m_videoVisible)
+        return;
+
+    m_videoVisible = visible;
+    applyVideoVisible();
+    Q_EMIT videoVisibleChanged();
+}
+
+void QUbuntuMedia::applyVideoVisible()
+{
+    if (m_player == nullptr || m_player->service() == nullptr)
+        return;
+
+    // Requesting the control creates a renderer if there is none, which an
+    // audio-only player has no use for. It is asked for once there is
+    // video, or again to undo what it was told before.
+    if (!m_player->isVideoAvailable() && !m_videoVisibleForwarded)
+        return;
+
+    // The control is the one shared with the VideoOutput, it is not released
+    // here as that would tear it down
+    QMediaControl *renderer = m_player->service()->requestControl(QVideoRendererControl_iid);
+    if (renderer == nullptr || !QMetaObject::invokeMethod(renderer, "setVisible", Q_ARG(bool, m_videoVisible))) {
+        DLOG("Video renderer doesn't support hiding video");
+        return;
+    }
+    m_videoVisibleForwarded = true;
+}
+
+void QUbuntuMedia::connectLoadProgress()
+{
+    // The playlist control of whichever service the playlist is handed to
+    QMediaObject *mediaObject = m_mediaPlaylist->mediaObject();
+    if (mediaObject == nullptr)
+        mediaObject = m_player;
+    QMediaService *service = mediaObject != nullptr ? mediaObject->service() : nullptr;
+    if (service == nullptr)
+        return;
+
+    // Requesting the control would hand it the player session again, it is
+    // only listened to here
+    QMediaPlaylistControl *control = service->findChild<QMediaPlaylistControl*>();
+    if (control == nullptr || control->metaObject()->indexOfSignal("loadProgress(int,int)") < 0)
+        return;
+
+    connect(control, SIGNAL(loadProgress(int,int)), this, SIGNAL(loadProgress(int,int)),
+            Qt::UniqueConnection);
+}
+
+void QUbuntuMedia::onVideoAvailableChanged(bool available)
+{
+    // Renderers start out visible
+    if (available && !m_videoVisible)
+        applyVideoVisible();
+}
+
+bool QUbuntuMedia::saveSnapshot(const QString &path) const
+{
+    PlaylistSnapshot snapshot;
+    snapshot.urls = m_qmlPlaylist;
+    // A restore that is still waiting for the player hasn't moved it yet
+    if (m_restoreIndex >= 0) {
+        snapshot.currentIndex = m_restoreIndex;
+        snapshot.position = m_restorePosition;
+    } else {
+        snapshot.currentIndex = m_mediaPlaylist->currentIndex();
+        snapshot.position = m_player ? m_player->position() : 0;
+    }
+    // PlaybackMode mirrors the QMediaPlaylist::PlaybackMode values
+    snapshot.playbackMode = m_mediaPlaylist->playbackMode();
+
+    return snapshot.save(path);
+}
+
+bool QUbuntuMedia::restoreSnapshot(const QString &path)
+{
+    if (m_player == nullptr)
+        return false;
+
+    PlaylistSnapshot snapshot;
+    if (!snapshot.load(path))
+        return false;
+
+    m_qmlPlaylist = snapshot.urls;
+    m_restoreIndex = -1;
 
-    // Wipe state
     if (!m_mediaPlaylist->isEmpty()) {
         m_mediaPlaylist->clear();
     }
 
-    if (playlist.empty())
+    if (snapshot.urls.empty())
+        return true;
+
+    // One addMedia() call ends up as a single addTracksWithUriAt() on the
+    // media-hub side, no matter how long the queue is
+    m_mediaPlaylist->addMedia(toMediaContents(snapshot.urls));
+
+    applyPlaybackMode(static_cast<PlaybackMode>(snapshot.playbackMode));
+
+    // See setPlaylist() for why the playlist is passed as a QIODevice
+    m_player->setMedia(0, reinterpret_cast<QIODevice*>(m_mediaPlaylist));
+
+    // Going to a track or seeking before the player has loaded the queue
+    // would get lost or land on the wrong track
+    m_restoreIndex = qBound(0, snapshot.currentIndex, snapshot.urls.size() - 1);
+    m_restorePosition = snapshot.position;
+    onMediaStatusChanged(m_player->mediaStatus());
+
+    Q_EMIT playlistChanged();
+    return true;
+}
+
+void QUbuntuMedia::onMediaStatusChanged(QMediaPlayer::MediaStatus status)
+{
+    if (m_restoreIndex < 0)
         return;
 
-    Q_FOREACH(const QUrl& mediaUrl, playlist) {
-        m_mediaPlaylist->addMedia(mediaUrl);
+    switch (status)
+    {
+    case QMediaPlayer::LoadedMedia:
+    case QMediaPlayer::BufferingMedia:
+    case QMediaPlayer::BufferedMedia:
+    case QMediaPlayer::StalledMedia:
+        applyRestoredPosition();
+        break;
+    case QMediaPlayer::InvalidMedia:
+        DLOG("Restored playlist failed to load, not going to track %d", m_restoreIndex);
+        m_restoreIndex = -1;
+        break;
+    default:
+        break;
     }
+}
+
+void QUbuntuMedia::applyRestoredPosition()
+{
+    const int index = m_restoreIndex;
+    m_restoreIndex = -1;
+
+    DLOG("Continuing restored playlist at track %d, %lld ms", index, m_restorePosition);
     m_mediaPlaylist->setCurrentIndex(index);
+    if (m_restorePosition > 0)
+        m_player->setPosition(m_restorePosition);
+}
 
+void QUbuntuMedia::applyPlaybackMode(PlaybackMode mode)
+{
     switch (mode)
     {
     case PlaybackMode::CurrentItemOnce: m_mediaPlaylist->setPlaybackMode(QMediaPlaylist::CurrentItemOnce); break;
@@ -58,19 +324,4 @@ void QUbuntuMedia::setPlaylist(const QList<QUrl> &playlist, int index, PlaybackM
     default:
         break;
     }
-   
-    // FIXME: This is a hack, however there is currently no other way to get a Playlist to
-    // the media controls. Qt takes it upon itself to walk playlists, that breaks our
-    // out-of-process scenario.
-    m_player->setMedia(0, reinterpret_cast<QIODevice*>(m_mediaPlaylist));
-
-    Q_EMIT playlistChanged();
-}
-
-void QUbuntuMedia::setMediaPlayer(QObject *mediaPlayer)
-{
-    if (mediaPlayer == m_player)
-        return;
-
-    m_player = qobject_cast<QMediaPlayer*>(mediaPlayer->property("mediaObject").value<QObject*>());
 }
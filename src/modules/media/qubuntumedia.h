@@ -27,6 +27,9 @@ class QUbuntuMedia : public QObject
     Q_OBJECT
     Q_PROPERTY(QList<QUrl> playlist READ playlist)
     Q_PROPERTY(QObject* mediaPlayer READ mediaPlayer WRITE setMediaPlayer NOTIFY mediaPlayerChanged)
+    // Bind to whether the VideoOutput can be seen, frames aren't presented
+    // while it can't
+    Q_PROPERTY(bool videoVisible READ videoVisible WRITE setVideoVisible NOTIFY videoVisibleChanged)
     Q_ENUMS(PlaybackMode)
         
 public:
@@ -41,20 +44,51 @@ public:
     QUbuntuMedia(QObject* parent = 0);
     
     Q_INVOKABLE void setPlaylist(const QList<QUrl> &playlist, int index = 1, PlaybackMode mode = Sequential);
+
+    // Persist the queue (tracks, current index, position and playback mode) to
+    // path and bring it back with a single batched add and seek
+    Q_INVOKABLE bool saveSnapshot(const QString &path) const;
+    Q_INVOKABLE bool restoreSnapshot(const QString &path);
     
     QList<QUrl> playlist() const { return m_qmlPlaylist; }
     QObject* mediaPlayer() const { return m_player; }
     void setMediaPlayer(QObject *mediaPlayer);
-
+    bool videoVisible() const { return m_videoVisible; }
+    void setVideoVisible(bool visible);
 
 Q_SIGNALS:
     void playlistChanged();
     void mediaPlayerChanged();
+    void videoVisibleChanged();
+    // Progress of handing a long playlist to the player in chunks,
+    // loaded == total once all of it can be played
+    void loadProgress(int loaded, int total);
+
+private Q_SLOTS:
+    void onMediaStatusChanged(QMediaPlayer::MediaStatus status);
+    void onVideoAvailableChanged(bool available);
 
 private:
+    void applyPlaybackMode(PlaybackMode mode);
+    // Puts the player where the restored snapshot left off, once it has loaded
+    void applyRestoredPosition();
+    void applyVideoVisible();
+    void connectLoadProgress();
+    // Turns the previous QML list into the new one with as few batched
+    // QMediaPlaylist operations as possible
+    void applyPlaylistEdits(const QList<QUrl> &from, const QList<QUrl> &to);
+    void insertMedia(int index, const QList<QUrl> &urls, bool append);
+    static QList<QMediaContent> toMediaContents(const QList<QUrl> &urls);
+
     QMediaPlayer *m_player;
     QList<QUrl> m_qmlPlaylist;
     QMediaPlaylist *m_mediaPlaylist;
     QMediaContent m_content; 
     int m_currIndex;
+    bool m_videoVisible;
+    // Whether the player's video renderer has been told about m_videoVisible
+    bool m_videoVisibleForwarded;
+    // Where restoreSnapshot() is to continue, -1 once there is nothing to do
+    int m_restoreIndex;
+    qint64 m_restorePosition;
 };
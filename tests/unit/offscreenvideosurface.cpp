@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "offscreenvideosurface.h"
+#include "softwarevideosink.h"
+
+#include <QVideoSurfaceFormat>
+
+OffscreenVideoSurface::OffscreenVideoSurface(QAbstractVideoBuffer::HandleType handleType,
+                                             QObject *parent)
+    : QAbstractVideoSurface(parent),
+      m_handleType(handleType),
+      m_presentedFrames(0),
+      m_startCount(0)
+{
+}
+
+QList<QVideoFrame::PixelFormat> OffscreenVideoSurface::supportedPixelFormats(
+        QAbstractVideoBuffer::HandleType handleType) const
+{
+    if (handleType != m_handleType)
+        return QList<QVideoFrame::PixelFormat>();
+
+    if (handleType == QAbstractVideoBuffer::GLTextureHandle)
+        return QList<QVideoFrame::PixelFormat>() << QVideoFrame::Format_RGB32;
+
+    return QList<QVideoFrame::PixelFormat>() << QVideoFrame::Format_NV12
+                                             << QVideoFrame::Format_RGB32;
+}
+
+bool OffscreenVideoSurface::start(const QVideoSurfaceFormat &format)
+{
+    ++m_startCount;
+    return QAbstractVideoSurface::start(format);
+}
+
+bool OffscreenVideoSurface::present(const QVideoFrame &frame)
+{
+    m_presentTimes.append(SoftwareVideoSink::steadyClockNs());
+    ++m_presentedFrames;
+    m_lastFrame = frame;
+    return true;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OFFSCREENVIDEOSURFACE_H
+#define OFFSCREENVIDEOSURFACE_H
+
+#include <QAbstractVideoSurface>
+#include <QVector>
+#include <QVideoFrame>
+
+// A QAbstractVideoSurface that doesn't draw anything, it only keeps track of
+// what the renderer presents to it
+class OffscreenVideoSurface : public QAbstractVideoSurface
+{
+    Q_OBJECT
+
+public:
+    // GLTextureHandle mimics a QML VideoOutput, NoHandle a software surface
+    // that wants CPU readable frames
+    OffscreenVideoSurface(QAbstractVideoBuffer::HandleType handleType = QAbstractVideoBuffer::GLTextureHandle,
+                          QObject *parent = 0);
+
+    QList<QVideoFrame::PixelFormat> supportedPixelFormats(
+            QAbstractVideoBuffer::HandleType handleType = QAbstractVideoBuffer::NoHandle) const;
+
+    bool start(const QVideoSurfaceFormat &format);
+    bool present(const QVideoFrame &frame);
+
+    int presentedFrames() const { return m_presentedFrames; }
+    int startCount() const { return m_startCount; }
+    QVideoFrame lastFrame() const { return m_lastFrame; }
+    // SoftwareVideoSink::steadyClockNs() of every present
+    const QVector<qint64> &presentTimes() const { return m_presentTimes; }
+
+private:
+    QAbstractVideoBuffer::HandleType m_handleType;
+    int m_presentedFrames;
+    int m_startCount;
+    QVideoFrame m_lastFrame;
+    QVector<qint64> m_presentTimes;
+};
+
+#endif // OFFSCREENVIDEOSURFACE_H
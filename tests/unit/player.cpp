@@ -17,8 +17,10 @@
  */
 
 #include "player.h"
+#include "softwarevideosink.h"
 
 #include <QDebug>
+#include <QUuid>
 #include <MediaHub/VideoSink>
 
 using namespace lomiri::MediaHub;
@@ -26,17 +28,6 @@ using namespace lomiri::MediaHub;
 namespace lomiri {
 namespace MediaHub {
 
-class NullVideoSink: public VideoSink
-{
-    Q_OBJECT
-
-public:
-    NullVideoSink(): VideoSink(nullptr) {}
-
-    bool swapBuffers() override { return true; }
-};
-
-
 class PlayerPrivate
 {
     Q_DECLARE_PUBLIC(Player)
@@ -70,7 +61,7 @@ private:
     Player::AudioStreamRole m_audioStreamRole = Player::MultimediaRole;
     QString m_uuid;
     TrackList *m_trackList = nullptr;
-    NullVideoSink m_videoSink;
+    SoftwareVideoSink m_videoSink;
     Player *q_ptr;
 };
 
@@ -78,6 +69,7 @@ private:
 } // namespace lomiri
 
 PlayerPrivate::PlayerPrivate(Player *q):
+    m_uuid(QUuid::createUuid().toString()),
     q_ptr(q)
 {
 }
@@ -90,6 +82,8 @@ Player::Player(QObject *parent):
     QObject(parent),
     d_ptr(new PlayerPrivate(this))
 {
+    // The sink is a SoftwareVideoSink, see AalMediaPlayerService::canMapVideoFrames()
+    setProperty("mappableVideoSinks", true);
 }
 
 Player::~Player() = default;
@@ -218,6 +212,9 @@ bool Player::shuffle() const
 
 void Player::setVolume(Volume volume)
 {
+    Q_D(Player);
+    d->m_volume = volume;
+    Q_EMIT volumeChanged();
 }
 
 Player::Volume Player::volume() const
@@ -282,4 +279,3 @@ Player::AudioStreamRole Player::audioStreamRole() const
     return d->m_audioStreamRole;
 }
 
-#include "player.moc"
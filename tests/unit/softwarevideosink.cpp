@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "softwarevideosink.h"
+
+#include <chrono>
+#include <cstring>
+
+SoftwareVideoSink::SoftwareVideoSink()
+    : lomiri::MediaHub::VideoSink(nullptr),
+      m_framesRead(0)
+{
+    m_frameTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_frameTimer, SIGNAL(timeout()), this, SLOT(produceFrame()));
+}
+
+void SoftwareVideoSink::start(qreal framesPerSecond)
+{
+    m_frameTimes.clear();
+    m_frameTimer.start(qRound(1000 / framesPerSecond));
+}
+
+void SoftwareVideoSink::stop()
+{
+    m_frameTimer.stop();
+}
+
+qint64 SoftwareVideoSink::steadyClockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void SoftwareVideoSink::produceFrame()
+{
+    m_frameTimes.append(steadyClockNs());
+    Q_EMIT frameAvailable();
+}
+
+bool SoftwareVideoSink::readFrame(uchar *bits, int bytesPerLine, const QSize &size,
+                                  QVideoFrame::PixelFormat format)
+{
+    int rows = size.height();
+    if (format == QVideoFrame::Format_NV12)
+        rows += size.height() / 2;
+
+    std::memset(bits, m_framesRead % 256, bytesPerLine * rows);
+    ++m_framesRead;
+    return true;
+}
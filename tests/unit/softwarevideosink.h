@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOFTWAREVIDEOSINK_H
+#define SOFTWAREVIDEOSINK_H
+
+#include "aalvideoframepool.h"
+
+#include <MediaHub/VideoSink>
+
+#include <QTimer>
+#include <QVector>
+
+// A VideoSink that needs no GPU: frames are synthesized in CPU memory, every
+// byte of frame n set to n % 256. Once started it announces new frames at a
+// fixed rate, like a decoder would, so the renderer's frame pacing and
+// latency can be measured on machines without GL.
+class SoftwareVideoSink : public lomiri::MediaHub::VideoSink, public AalMappableFrameSource
+{
+    Q_OBJECT
+
+public:
+    SoftwareVideoSink();
+
+    bool swapBuffers() override { return true; }
+
+    bool readFrame(uchar *bits, int bytesPerLine, const QSize &size,
+                   QVideoFrame::PixelFormat format) override;
+
+    void start(qreal framesPerSecond);
+    void stop();
+
+    int framesRead() const { return m_framesRead; }
+    // steadyClockNs() of every frameAvailable() emitted since start()
+    const QVector<qint64> &frameTimes() const { return m_frameTimes; }
+
+    static qint64 steadyClockNs();
+
+private Q_SLOTS:
+    void produceFrame();
+
+private:
+    QTimer m_frameTimer;
+    QVector<qint64> m_frameTimes;
+    int m_framesRead;
+};
+
+#endif // SOFTWAREVIDEOSINK_H
@@ -0,0 +1,126 @@
+/*
+ * Copyright © 2021 UBports Foundation.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <MediaHub/Track>
+#include <MediaHub/TrackList>
+
+#include <QUrl>
+#include <QVector>
+
+using namespace lomiri::MediaHub;
+
+namespace lomiri {
+namespace MediaHub {
+
+/* Keeps the tracks in memory and answers every call right away, like
+ * media-hub does once its reply and signals have arrived. As in media-hub,
+ * edits around the current track keep it current without announcing it. */
+class TrackListPrivate
+{
+    Q_DECLARE_PUBLIC(TrackList)
+
+public:
+    TrackListPrivate(TrackList *q): q_ptr(q) {}
+
+private:
+    QVector<Track> m_tracks;
+    int m_currentTrack = 0;
+    TrackList *q_ptr;
+};
+
+} // namespace MediaHub
+} // namespace lomiri
+
+TrackList::TrackList(QObject *parent):
+    QObject(parent),
+    d_ptr(new TrackListPrivate(this))
+{
+}
+
+TrackList::~TrackList() = default;
+
+bool TrackList::canEditTracks() const
+{
+    return true;
+}
+
+QVector<Track> TrackList::tracks() const
+{
+    Q_D(const TrackList);
+    return d->m_tracks;
+}
+
+int TrackList::currentTrack() const
+{
+    Q_D(const TrackList);
+    return d->m_currentTrack;
+}
+
+void TrackList::addTrackWithUriAt(const QUrl &uri, int position, bool makeCurrent)
+{
+    Q_D(TrackList);
+    addTracksWithUriAt({ uri }, position);
+    if (makeCurrent)
+        goTo(position < 0 ? d->m_tracks.count() - 1 : position);
+}
+
+void TrackList::addTracksWithUriAt(const QVector<QUrl> &uris, int position)
+{
+    Q_D(TrackList);
+    const int start = position < 0 ? d->m_tracks.count() : position;
+    for (int i = 0; i < uris.count(); ++i)
+        d->m_tracks.insert(start + i, Track(uris[i]));
+    if (start <= d->m_currentTrack && d->m_tracks.count() > uris.count())
+        d->m_currentTrack += uris.count();
+    Q_EMIT tracksAdded(start, start + uris.count() - 1);
+}
+
+void TrackList::moveTrack(int index, int to)
+{
+    Q_D(TrackList);
+    d->m_tracks.move(index, to);
+    if (d->m_currentTrack == index)
+        d->m_currentTrack = to;
+    else if (index < d->m_currentTrack && d->m_currentTrack <= to)
+        --d->m_currentTrack;
+    else if (to <= d->m_currentTrack && d->m_currentTrack < index)
+        ++d->m_currentTrack;
+    Q_EMIT trackMoved(index, to);
+}
+
+void TrackList::removeTrack(int index)
+{
+    Q_D(TrackList);
+    d->m_tracks.remove(index);
+    if (index < d->m_currentTrack)
+        --d->m_currentTrack;
+    Q_EMIT trackRemoved(index);
+}
+
+void TrackList::goTo(int index)
+{
+    Q_D(TrackList);
+    d->m_currentTrack = index;
+    Q_EMIT currentTrackChanged();
+}
+
+void TrackList::reset()
+{
+    Q_D(TrackList);
+    d->m_tracks.clear();
+    d->m_currentTrack = 0;
+    Q_EMIT trackListReset();
+}
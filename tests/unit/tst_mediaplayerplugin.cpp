@@ -15,13 +15,32 @@
  */
 
 #include "player.h"
+#include "aalbackendwatchdog.h"
+#include "aalflightrecorder.h"
+#include "aallogging.h"
 #include "aalmediaplayerservice.h"
+#include "aalmediaplaylistcontrol.h"
+#include "aalplayercommandqueue.h"
+#include "aaltracer.h"
 #include "aalutility.h"
 #include "tst_mediaplayerplugin.h"
 #include "tst_mediaplaylistcontrol.h"
+#include "tst_qubuntumedia.h"
+#include "tst_videorenderercontrol.h"
+
+#include <private/qmediaplaylistprovider_p.h>
+
+#include <MediaHub/TrackList>
 
 #include <memory>
+#include <random>
 
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QQueue>
+#include <QTemporaryDir>
+#include <QThread>
 #include <QVideoRendererControl>
 #include <QtTest/QtTest>
 
@@ -129,7 +148,467 @@ void tst_MediaPlayerPlugin::tst_isVideoSource()
 
 void tst_MediaPlayerPlugin::tst_volume()
 {
-    QVERIFY(m_mediaPlayerControl->volume() == 1);
+    // media-hub's 0 to 1 shows as QMediaPlayer's 0 to 100
+    QCOMPARE(m_mediaPlayerControl->volume(), 100);
+    m_mediaPlayerControl->setVolume(40);
+    QCOMPARE(m_service->getPlayer()->volume(), 0.4);
+    QCOMPARE(m_mediaPlayerControl->volume(), 40);
+    m_mediaPlayerControl->setVolume(100);
+}
+
+void tst_MediaPlayerPlugin::tst_detachRestoreSession()
+{
+    m_service->setMedia(QUrl("file:///tmp/video.mp4"), Player::Headers());
+    m_service->setPosition(5000);
+
+    const AalSessionSnapshot snapshot = m_service->captureSession();
+    QCOMPARE(snapshot.uri, QUrl("file:///tmp/video.mp4"));
+    QCOMPARE(snapshot.position, quint64(5000000));
+
+    QVERIFY(m_service->detachSession());
+    QVERIFY(m_service->isSessionDetached());
+    QVERIFY(m_service->getPlayer() == nullptr);
+    QVERIFY(!m_service->detachSession());
+
+    QVERIFY(m_service->restoreSession());
+    QVERIFY(!m_service->isSessionDetached());
+    QVERIFY(m_service->getPlayer() != nullptr);
+    QCOMPARE(m_service->getPlayer()->position(), quint64(5000000));
+    QCOMPARE(m_mediaPlayerControl->position(), qint64(5000));
+    QVERIFY(m_service->lastResumeLatency() >= 0);
+}
+
+void tst_MediaPlayerPlugin::tst_restorePlaylistSession()
+{
+    m_service->requestControl(QMediaPlaylistControl_iid);
+    AalMediaPlaylistControl *control = m_service->mediaPlaylistControl();
+    QList<QMediaContent> tracks;
+    for (int i = 0; i < 4; ++i)
+        tracks.append(QMediaContent(QUrl(QStringLiteral("file:///tmp/track%1.ogg").arg(i))));
+    control->playlistProvider()->addMedia(tracks);
+    QCoreApplication::processEvents();
+    control->setCurrentIndex(2);
+    m_service->setPosition(7000);
+
+    const AalSessionSnapshot snapshot = m_service->captureSession();
+    QCOMPARE(snapshot.currentTrack, 2);
+    QCOMPARE(snapshot.position, quint64(7000000));
+    QVERIFY(m_service->detachSession());
+
+    AalBackendWatchdog *watchdog = AalBackendWatchdog::instance();
+    const qint64 budget = watchdog->budgetUs();
+    watchdog->clear();
+    watchdog->setBudgetUs(-1);
+    QVERIFY(m_service->restoreSession());
+    watchdog->setBudgetUs(budget);
+
+    // The position belongs to the restored track, so it's only sought to
+    // once media-hub went there
+    QStringList calls;
+    for (const AalBackendCall &call : watchdog->slowCalls())
+        calls.append(QString(call.call));
+    watchdog->clear();
+    const int goTo = calls.indexOf(QStringLiteral("TrackList::goTo"));
+    QVERIFY(goTo >= 0);
+    QVERIFY(calls.indexOf(QStringLiteral("Player::seekTo")) > goTo);
+
+    TrackList *trackList = m_service->getPlayer()->trackList();
+    QCOMPARE(trackList->tracks().count(), 4);
+    QCOMPARE(trackList->currentTrack(), 2);
+    QCOMPARE(control->currentIndex(), 2);
+    QCOMPARE(m_service->getPlayer()->position(), quint64(7000000));
+}
+
+void tst_MediaPlayerPlugin::tst_recoverAfterServiceRestart()
+{
+    m_service->setMedia(QUrl("file:///tmp/video.mp4"), Player::Headers());
+    m_service->setPosition(3000);
+
+    // Keeps the old session alive until the signals are done with it
+    const std::shared_ptr<Player> oldPlayer = m_service->getPlayer();
+
+    // The dead session isn't asked for what it was doing
+    AalBackendWatchdog *watchdog = AalBackendWatchdog::instance();
+    const qint64 budget = watchdog->budgetUs();
+    watchdog->clear();
+    watchdog->setBudgetUs(-1);
+    Q_EMIT oldPlayer->serviceDisconnected();
+    watchdog->setBudgetUs(budget);
+    for (const AalBackendCall &call : watchdog->slowCalls())
+        QVERIFY2(!QByteArray(call.call).startsWith("Player"), call.call);
+    watchdog->clear();
+    QCOMPARE(m_mediaPlayerControl->mediaStatus(), QMediaPlayer::StalledMedia);
+    Q_EMIT oldPlayer->serviceReconnected();
+
+    QTRY_VERIFY(m_service->lastRecoveryTime() >= 0);
+    QVERIFY(m_service->getPlayer() != nullptr);
+    QVERIFY(m_service->getPlayer() != oldPlayer);
+    QCOMPARE(m_service->getPlayer()->position(), quint64(3000000));
+    QVERIFY(!m_service->isSessionDetached());
+}
+
+void tst_MediaPlayerPlugin::tst_commandQueue()
+{
+    const std::shared_ptr<Player> player = std::make_shared<Player>();
+
+    // Without the worker thread commands reach the session right away
+    AalPlayerCommandQueue inlineQueue(false);
+    inlineQueue.setPlayer(player);
+    inlineQueue.seekTo(1000);
+    QCOMPARE(player->position(), quint64(1000));
+
+    AalPlayerCommandQueue queue(true);
+    queue.setPlayer(player);
+    for (quint64 i = 1; i <= 1000; ++i)
+        queue.seekTo(i * 1000);
+    queue.play();
+    queue.flush();
+
+    // Seeks queued behind each other collapse into the latest one
+    QCOMPARE(queue.pendingCommands(), 0);
+    QCOMPARE(player->position(), quint64(1000000));
+    QVERIFY(queue.coalescedCommands() < 1000);
+
+    // Nothing is sent while another thread is using the session, and
+    // commands aren't moved across an openUri()
+    const quint64 coalesced = queue.coalescedCommands();
+    queue.backendLock()->mutex()->lock();
+    queue.pause();
+    queue.openUri(QUrl("file:///tmp/other.mp4"), Player::Headers());
+    queue.play();
+    QCOMPARE(queue.pendingCommands(), 3);
+    queue.pause();
+    QCOMPARE(queue.pendingCommands(), 3);
+    QCOMPARE(queue.coalescedCommands(), coalesced + 1);
+    queue.backendLock()->mutex()->unlock();
+    queue.flush();
+    QCOMPARE(queue.pendingCommands(), 0);
+
+    // Only a seek right behind another one replaces it, the one before a
+    // stop() is still sent before it
+    queue.backendLock()->mutex()->lock();
+    queue.seekTo(1000);
+    queue.stop();
+    queue.seekTo(2000);
+    QCOMPARE(queue.pendingCommands(), 3);
+    QCOMPARE(queue.coalescedCommands(), coalesced + 1);
+    queue.backendLock()->mutex()->unlock();
+    queue.flush();
+    QCOMPARE(queue.pendingCommands(), 0);
+    QCOMPARE(player->position(), quint64(2000));
+
+    // What the commands did is read back once they are all sent
+    QVERIFY(queue.state().valid);
+    QCOMPARE(queue.state().position, quint64(2000));
+
+    // Nothing reaches a session that has been released
+    queue.setPlayer(nullptr);
+    queue.seekTo(5000);
+    queue.flush();
+    QCOMPARE(player->position(), quint64(1000000));
+}
+
+void tst_MediaPlayerPlugin::tst_slowBackendCalls()
+{
+    AalBackendWatchdog *watchdog = AalBackendWatchdog::instance();
+    const qint64 budget = watchdog->budgetUs();
+    watchdog->clear();
+    QSignalSpy slowCallSpy(watchdog, &AalBackendWatchdog::slowCallDetected);
+
+    // Every call is over budget
+    watchdog->setBudgetUs(-1);
+    m_service->duration();
+    watchdog->setBudgetUs(budget);
+
+    QCOMPARE(slowCallSpy.count(), 1);
+    QCOMPARE(slowCallSpy.at(0).at(0).toString(), QString("Player::duration"));
+    QVERIFY(slowCallSpy.at(0).at(1).toString().contains("AalMediaPlayerService::duration"));
+
+    const QVector<AalBackendCall> slowCalls = watchdog->slowCalls();
+    QCOMPARE(slowCalls.size(), 1);
+    QCOMPARE(QString(slowCalls.first().call), QString("Player::duration"));
+
+    // Only the latest slow calls are kept
+    watchdog->setBudgetUs(-1);
+    for (int i = 0; i < AalBackendWatchdog::HistorySize; ++i)
+        m_service->isVideoSource();
+    watchdog->setBudgetUs(budget);
+    QCOMPARE(watchdog->slowCallCount(), quint64(AalBackendWatchdog::HistorySize + 1));
+    QCOMPARE(watchdog->slowCalls().size(), int(AalBackendWatchdog::HistorySize));
+    QCOMPARE(QString(watchdog->slowCalls().first().call), QString("Player::isVideoSource"));
+    watchdog->clear();
+}
+
+void tst_MediaPlayerPlugin::tst_flightRecorder()
+{
+    AalFlightRecorder &recorder = m_service->flightRecorder();
+    m_service->setPosition(2000);
+
+    QVector<AalFlightRecorder::Event> events = recorder.events();
+    QVERIFY(!events.isEmpty());
+    QCOMPARE(int(events.last().type), int(AalFlightRecorder::Seek));
+    QCOMPARE(events.last().value, qint64(2000000));
+
+    // Only the latest events are kept, oldest first
+    for (int i = 0; i < AalFlightRecorder::Capacity + 10; ++i)
+        recorder.record(AalFlightRecorder::Buffering, i);
+    events = recorder.events();
+    QCOMPARE(events.size(), int(AalFlightRecorder::Capacity));
+    QCOMPARE(events.first().value, qint64(10));
+    QCOMPARE(events.last().value, qint64(AalFlightRecorder::Capacity + 9));
+    QCOMPARE(events.last().sequence, recorder.recordedEvents());
+
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + "/dump.aalrec";
+    QVERIFY(m_service->dumpFlightRecorder(fileName));
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.read(sizeof(AalFlightRecorder::Magic)),
+             QByteArray(AalFlightRecorder::Magic, sizeof(AalFlightRecorder::Magic)));
+}
+
+void tst_MediaPlayerPlugin::tst_tracer()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + "/trace.json";
+    QScopedPointer<AalTracer> tracer(new AalTracer(fileName));
+
+    tracer->complete("complete", "test", AalTracer::now(), 1.5);
+    tracer->instant("instant", "test", "index", 3);
+    QThread thread;
+    thread.setObjectName(QStringLiteral("Worker \"1\""));
+    connect(&thread, &QThread::started, [&tracer]() {
+        tracer->asyncBegin("async", "test", 7);
+    });
+    thread.start();
+    thread.quit();
+    QVERIFY(thread.wait());
+    tracer->asyncEnd("async", "test", 7);
+
+    // What a crash would leave behind is already on disk and only lacks
+    // the closing bracket
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QJsonParseError error;
+    QJsonDocument trace = QJsonDocument::fromJson(file.readAll() + "]", &error);
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    QVERIFY(trace.isArray());
+
+    tracer.reset();
+    QVERIFY(file.seek(0));
+    trace = QJsonDocument::fromJson(file.readAll(), &error);
+    QCOMPARE(error.error, QJsonParseError::NoError);
+
+    QStringList phases;
+    for (const QJsonValue &value : trace.array()) {
+        const QJsonObject event = value.toObject();
+        QVERIFY(event.contains("ph"));
+        QVERIFY(event.contains("pid"));
+        QVERIFY(event.contains("tid"));
+        if (event["ph"].toString() != "M")
+            QVERIFY(event["ts"].isDouble());
+        phases.append(event["ph"].toString());
+    }
+    // Each of the two threads is named once
+    QCOMPARE(phases, QStringList({ "M", "X", "i", "M", "b", "e" }));
+    QCOMPARE(trace.array()[2].toObject()["args"].toObject()["index"].toInt(), 3);
+}
+
+void tst_MediaPlayerPlugin::tst_loggingOverhead_data()
+{
+    QTest::addColumn<int>("logging");
+
+    // How state() used to log every call
+    QTest::newRow("qDebug") << 0;
+    QTest::newRow("disabled category") << 1;
+    QTest::newRow("state()") << 2;
+}
+
+void tst_MediaPlayerPlugin::tst_loggingOverhead()
+{
+    QFETCH(int, logging);
+
+    // Only the cost of producing the messages is of interest
+    const QtMessageHandler previousHandler =
+            qInstallMessageHandler([](QtMsgType, const QMessageLogContext &, const QString &) {});
+
+    QMediaPlayer::State state = QMediaPlayer::PlayingState;
+    switch (logging) {
+    case 0:
+        QBENCHMARK {
+            qDebug() << __PRETTY_FUNCTION__ << endl;
+            state = m_mediaPlayerControl->state();
+        }
+        break;
+    case 1:
+        QBENCHMARK {
+            qCDebug(aalPlayer) << __PRETTY_FUNCTION__;
+            state = m_mediaPlayerControl->state();
+        }
+        break;
+    default:
+        QBENCHMARK {
+            state = m_mediaPlayerControl->state();
+        }
+    }
+
+    qInstallMessageHandler(previousHandler);
+    QCOMPARE(state, m_mediaPlayerControl->state());
+}
+
+void tst_MediaPlayerPlugin::tst_positionPushes()
+{
+    const std::shared_ptr<Player> player = m_service->getPlayer();
+    QSignalSpy positionSpy(m_mediaPlayerControl, &QMediaPlayerControl::positionChanged);
+    m_service->setPositionGranularity(1000);
+
+    // Pushed positions are cached, media-hub isn't asked while paused
+    Q_EMIT player->positionChanged(2000000);
+    QCOMPARE(positionSpy.count(), 1);
+    QCOMPARE(positionSpy.at(0).at(0).toLongLong(), qint64(2000));
+    player->seekTo(0);
+    QCOMPARE(m_mediaPlayerControl->position(), qint64(2000));
+
+    // Small steps aren't passed on
+    Q_EMIT player->positionChanged(2500000);
+    QCOMPARE(positionSpy.count(), 1);
+    QCOMPARE(m_mediaPlayerControl->position(), qint64(2500));
+    Q_EMIT player->positionChanged(3000000);
+    QCOMPARE(positionSpy.count(), 2);
+
+    // Seeks always are
+    Q_EMIT player->seekedTo(3100000);
+    QCOMPARE(positionSpy.count(), 3);
+    QCOMPARE(m_mediaPlayerControl->position(), qint64(3100));
+
+    // Seeking drops the cache until media-hub reports the new position
+    m_service->setPosition(7000);
+    QCOMPARE(m_mediaPlayerControl->position(), qint64(player->position() / 1e6));
+}
+
+void tst_MediaPlayerPlugin::tst_stateMachineStress()
+{
+    QSignalSpy stateSpy(m_mediaPlayerControl, &QMediaPlayerControl::stateChanged);
+    std::mt19937 random(42);
+
+    // media-hub works through the commands in order, some time after they
+    // were made. It reports every state it reaches, sometimes with Ready
+    // (reported as Paused) on the way to playing or stopping, and ends the
+    // stream on its own now and then.
+    QQueue<QMediaPlayer::State> hubCommands;
+    QMediaPlayer::State hubState = m_mediaPlayerControl->state();
+    QMediaPlayer::State requested = hubState;
+
+    for (int i = 0; i < 4000; ++i)
+    {
+        const int emitted = stateSpy.count();
+        switch (random() % 6)
+        {
+        case 0:
+            m_mediaPlayerControl->play();
+            requested = QMediaPlayer::PlayingState;
+            hubCommands.enqueue(requested);
+            break;
+        case 1:
+            m_mediaPlayerControl->pause();
+            requested = QMediaPlayer::PausedState;
+            hubCommands.enqueue(requested);
+            break;
+        case 2:
+            m_mediaPlayerControl->stop();
+            requested = QMediaPlayer::StoppedState;
+            hubCommands.enqueue(requested);
+            break;
+        case 3:
+        case 4:
+            if (!hubCommands.isEmpty())
+            {
+                const QMediaPlayer::State target = hubCommands.dequeue();
+                if (target != hubState)
+                {
+                    if (target != QMediaPlayer::PausedState
+                            && hubState != QMediaPlayer::PausedState && random() % 2)
+                        m_mediaPlayerControl->updateBackendState(QMediaPlayer::PausedState);
+                    hubState = target;
+                    m_mediaPlayerControl->updateBackendState(hubState);
+                }
+            }
+            break;
+        default:
+            if (hubCommands.isEmpty() && hubState == QMediaPlayer::PlayingState)
+            {
+                hubState = QMediaPlayer::StoppedState;
+                m_mediaPlayerControl->updateBackendState(hubState);
+                requested = hubState;
+            }
+            break;
+        }
+
+        // The state follows the commands and what media-hub does on its
+        // own, late and intermediate reports never pull it back
+        QCOMPARE(m_mediaPlayerControl->state(), requested);
+        QVERIFY(stateSpy.count() - emitted <= 1);
+    }
+
+    while (!hubCommands.isEmpty())
+    {
+        const QMediaPlayer::State target = hubCommands.dequeue();
+        if (target != hubState)
+        {
+            hubState = target;
+            m_mediaPlayerControl->updateBackendState(hubState);
+        }
+    }
+
+    QCOMPARE(m_mediaPlayerControl->pendingCommands(), 0);
+    QCOMPARE(m_mediaPlayerControl->state(), requested);
+    // Every emission is a transition
+    for (int i = 1; i < stateSpy.count(); ++i)
+        QVERIFY(stateSpy.at(i).at(0).value<QMediaPlayer::State>() !=
+                stateSpy.at(i - 1).at(0).value<QMediaPlayer::State>());
+}
+
+void tst_MediaPlayerPlugin::tst_stateMachineUnsolicited()
+{
+    QSignalSpy stateSpy(m_mediaPlayerControl, &QMediaPlayerControl::stateChanged);
+    m_mediaPlayerControl->play();
+    m_mediaPlayerControl->updateBackendState(QMediaPlayer::PlayingState);
+    QCOMPARE(m_mediaPlayerControl->pendingCommands(), 0);
+
+    // Playback failing while a pause() is on its way wins over the pause()
+    m_mediaPlayerControl->pause();
+    QCOMPARE(m_mediaPlayerControl->state(), QMediaPlayer::PausedState);
+    m_mediaPlayerControl->updateBackendState(QMediaPlayer::StoppedState);
+    QCOMPARE(m_mediaPlayerControl->state(), QMediaPlayer::StoppedState);
+    QCOMPARE(m_mediaPlayerControl->pendingCommands(), 0);
+
+    // Ready on the way to playing isn't a pause
+    stateSpy.clear();
+    m_mediaPlayerControl->play();
+    m_mediaPlayerControl->updateBackendState(QMediaPlayer::PausedState);
+    QCOMPARE(m_mediaPlayerControl->state(), QMediaPlayer::PlayingState);
+    QCOMPARE(m_mediaPlayerControl->pendingCommands(), 1);
+    m_mediaPlayerControl->updateBackendState(QMediaPlayer::PlayingState);
+    QCOMPARE(m_mediaPlayerControl->pendingCommands(), 0);
+    QCOMPARE(stateSpy.count(), 1);
+
+    // The end of the stream comes through once nothing is pending
+    m_mediaPlayerControl->updateBackendState(QMediaPlayer::StoppedState);
+    QCOMPARE(m_mediaPlayerControl->state(), QMediaPlayer::StoppedState);
+    QCOMPARE(stateSpy.count(), 2);
+
+    // A play() waiting for the video output doesn't time out meanwhile
+    m_mediaPlayerControl->m_settleTimer.setInterval(20);
+    m_mediaPlayerControl->play();
+    m_mediaPlayerControl->deferSettling();
+    QTest::qWait(100);
+    QCOMPARE(m_mediaPlayerControl->state(), QMediaPlayer::PlayingState);
+    QCOMPARE(m_mediaPlayerControl->pendingCommands(), 1);
+
+    // but once it's sent media-hub has to confirm it in time
+    m_mediaPlayerControl->resumeSettling();
+    QTRY_COMPARE(m_mediaPlayerControl->pendingCommands(), 0);
+    QCOMPARE(m_mediaPlayerControl->state(), QMediaPlayer::StoppedState);
 }
 
 int main(int argc, char **argv)
@@ -138,5 +617,12 @@ int main(int argc, char **argv)
     QCoreApplication app(argc, argv);
     tst_MediaPlayerPlugin mpp;
     tst_MediaPlaylistControl mpc;
-    return (QTest::qExec(&mpp, argc, argv) && QTest::qExec(&mpc, argc, argv));
+    tst_VideoRendererControl vrc;
+    tst_QUbuntuMedia qum;
+    // qExec() returns 0 on success, so run every suite and report any failure
+    int status = QTest::qExec(&mpp, argc, argv);
+    status |= QTest::qExec(&mpc, argc, argv);
+    status |= QTest::qExec(&vrc, argc, argv);
+    status |= QTest::qExec(&qum, argc, argv);
+    return status;
 }
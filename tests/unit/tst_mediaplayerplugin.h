@@ -52,4 +52,16 @@ private Q_SLOTS:
     void tst_isAudioSource();
     void tst_isVideoSource();
     void tst_volume();
+    void tst_detachRestoreSession();
+    void tst_restorePlaylistSession();
+    void tst_recoverAfterServiceRestart();
+    void tst_commandQueue();
+    void tst_slowBackendCalls();
+    void tst_flightRecorder();
+    void tst_tracer();
+    void tst_loggingOverhead_data();
+    void tst_loggingOverhead();
+    void tst_positionPushes();
+    void tst_stateMachineStress();
+    void tst_stateMachineUnsolicited();
 };
@@ -15,16 +15,50 @@
  */
 
 #include "player.h"
+#include "aalbackendwatchdog.h"
 #include "aalmediaplayerservice.h"
 #include "aalmediaplaylistcontrol.h"
+#include "aalmediaplaylistprovider.h"
 #include "tst_mediaplayerplugin.h"
 #include "tst_mediaplaylistcontrol.h"
 
+#include <private/qmediaplaylistprovider_p.h>
+
+#include <MediaHub/TrackList>
+
 #include <QObject>
 #include <QtTest/QtTest>
 
 using namespace lomiri::MediaHub;
 
+namespace {
+
+// Tracks the control can see without a media-hub track list behind them
+class FixedPlaylistProvider : public QMediaPlaylistProvider
+{
+public:
+    FixedPlaylistProvider(int count): m_count(count) {}
+
+    int mediaCount() const override { return m_count; }
+    QMediaContent media(int index) const override
+    {
+        return QMediaContent(QUrl(QStringLiteral("file:///track%1.ogg").arg(index)));
+    }
+
+private:
+    int m_count;
+};
+
+QList<QMediaContent> makeTracks(int count, const QString &prefix = QStringLiteral("track"))
+{
+    QList<QMediaContent> tracks;
+    for (int i = 0; i < count; ++i)
+        tracks.append(QMediaContent(QUrl(QStringLiteral("file:///%1%2.ogg").arg(prefix).arg(i))));
+    return tracks;
+}
+
+} // namespace
+
 void tst_MediaPlaylistControl::initTestCase()
 {
     m_service = new AalMediaPlayerService(this);
@@ -52,6 +86,297 @@ void tst_MediaPlaylistControl::setAndVerifyCurrentIndex()
     QVERIFY(playlistControl()->currentIndex() == index);
 }
 
+void tst_MediaPlaylistControl::optimisticSkip()
+{
+    AalMediaPlayerService service;
+    service.requestControl(QMediaPlaylistControl_iid);
+    AalMediaPlaylistControl *control = service.mediaPlaylistControl();
+    QMediaPlaylistProvider *provider = control->playlistProvider();
+    TrackList *trackList = service.getPlayer()->trackList();
+    provider->addMedia(makeTracks(5));
+    QCoreApplication::processEvents();
+
+    qRegisterMetaType<QMediaContent>();
+    QSignalSpy indexSpy(control, &AalMediaPlaylistControl::currentIndexChanged);
+    QSignalSpy mediaSpy(control, &AalMediaPlaylistControl::currentMediaChanged);
+    QCOMPARE(control->currentIndex(), 0);
+
+    // A single skip shows up and reaches media-hub right away
+    control->next();
+    QCOMPARE(control->currentIndex(), 1);
+    QCOMPARE(trackList->currentTrack(), 1);
+    QCOMPARE(control->pendingSkip(), -1);
+    QCOMPARE(indexSpy.count(), 1);
+    QCOMPARE(indexSpy.at(0).at(0).toInt(), 1);
+    QCOMPARE(mediaSpy.count(), 1);
+    QCOMPARE(mediaSpy.at(0).at(0).value<QMediaContent>(), provider->media(1));
+
+    // The skips following it are shown too
+    control->next();
+    control->next();
+    control->previous();
+    QCOMPARE(control->currentIndex(), 2);
+    QCOMPARE(indexSpy.count(), 4);
+    QCOMPARE(mediaSpy.count(), 4);
+    QCOMPARE(mediaSpy.last().at(0).value<QMediaContent>(), provider->media(2));
+
+    // but media-hub is only told where the burst ended
+    QCOMPARE(trackList->currentTrack(), 1);
+    QCOMPARE(control->pendingSkip(), 2);
+
+    // and isn't asked where it is while the skip waits to be sent
+    AalBackendWatchdog *watchdog = AalBackendWatchdog::instance();
+    const qint64 budget = watchdog->budgetUs();
+    watchdog->clear();
+    watchdog->setBudgetUs(-1);
+    Q_EMIT trackList->currentTrackChanged();
+    watchdog->setBudgetUs(budget);
+    QVERIFY(watchdog->slowCalls().isEmpty());
+    QCOMPARE(control->currentIndex(), 2);
+    QTRY_COMPARE(trackList->currentTrack(), 2);
+    QCOMPARE(control->pendingSkip(), -1);
+    QCOMPARE(indexSpy.count(), 4);
+
+    // Tracks removed before the skip is sent drop it
+    QTest::qWait(250);
+    control->next();
+    control->next();
+    QCOMPARE(trackList->currentTrack(), 3);
+    QCOMPARE(control->pendingSkip(), 4);
+    provider->removeMedia(4);
+    QTRY_COMPARE(control->pendingSkip(), -1);
+    QTest::qWait(250);
+    QVERIFY(trackList->currentTrack() < 4);
+    QCOMPARE(trackList->tracks().count(), 4);
+}
+
+void tst_MediaPlaylistControl::currentIndexAfterEdits()
+{
+    AalMediaPlayerService service;
+    service.requestControl(QMediaPlaylistControl_iid);
+    AalMediaPlaylistControl *control = service.mediaPlaylistControl();
+    QMediaPlaylistProvider *provider = control->playlistProvider();
+
+    QList<QMediaContent> tracks;
+    for (int i = 0; i < 5; ++i)
+        tracks.append(QMediaContent(QUrl(QStringLiteral("file:///track%1.ogg").arg(i))));
+    provider->addMedia(tracks);
+    control->setCurrentIndex(3);
+    QCOMPARE(control->currentIndex(), 3);
+    QCoreApplication::processEvents();
+
+    QSignalSpy indexSpy(control, &AalMediaPlaylistControl::currentIndexChanged);
+
+    // Several edits before the current track are answered by one refresh
+    provider->removeMedia(0);
+    provider->removeMedia(1);
+    QCOMPARE(indexSpy.count(), 0);
+    QTRY_COMPARE(indexSpy.count(), 1);
+    QCOMPARE(indexSpy.at(0).at(0).toInt(), 1);
+    QCOMPARE(control->currentIndex(), 1);
+
+    provider->insertMedia(0, tracks.mid(0, 2));
+    QTRY_COMPARE(indexSpy.count(), 2);
+    QCOMPARE(indexSpy.at(1).at(0).toInt(), 3);
+    QCOMPARE(control->currentIndex(), 3);
+    QCOMPARE(provider->media(3), tracks[3]);
+
+    // Edits after it can't move it
+    provider->removeMedia(4);
+    provider->addMedia(tracks[4]);
+    QCoreApplication::processEvents();
+    QCOMPARE(indexSpy.count(), 2);
+    QCOMPARE(control->currentIndex(), 3);
+}
+
+void tst_MediaPlaylistControl::moveTracks()
+{
+    AalMediaPlayerService service;
+    service.requestControl(QMediaPlaylistControl_iid);
+    AalMediaPlaylistControl *control = service.mediaPlaylistControl();
+    AalMediaPlaylistProvider *provider =
+        static_cast<AalMediaPlaylistProvider*>(control->playlistProvider());
+
+    QList<QMediaContent> tracks;
+    for (int i = 0; i < 5; ++i)
+        tracks.append(QMediaContent(QUrl(QStringLiteral("file:///track%1.ogg").arg(i))));
+    provider->addMedia(tracks);
+    control->setCurrentIndex(1);
+    QCoreApplication::processEvents();
+
+    QSignalSpy indexSpy(control, &AalMediaPlaylistControl::currentIndexChanged);
+    QSignalSpy changedSpy(provider, &QMediaPlaylistProvider::mediaChanged);
+    QSignalSpy removedSpy(provider, &QMediaPlaylistProvider::mediaRemoved);
+    QSignalSpy insertedSpy(provider, &QMediaPlaylistProvider::mediaInserted);
+    QSignalSpy movedSpy(provider, &AalMediaPlaylistProvider::mediaMoved);
+
+    // A move is one changed range, the current track goes along with it
+    QVERIFY(provider->moveMedia(1, 3));
+    QCOMPARE(movedSpy.count(), 1);
+    QCOMPARE(movedSpy.at(0).at(0).toInt(), 1);
+    QCOMPARE(movedSpy.at(0).at(1).toInt(), 3);
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).toInt(), 1);
+    QCOMPARE(changedSpy.at(0).at(1).toInt(), 3);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(insertedSpy.count(), 0);
+    QCOMPARE(provider->media(3), tracks[1]);
+    QCOMPARE(control->currentIndex(), 3);
+    QCOMPARE(indexSpy.count(), 1);
+
+    // Moves across the current track shift it
+    QVERIFY(provider->moveMedia(4, 0));
+    QCOMPARE(control->currentIndex(), 4);
+    QCOMPARE(indexSpy.count(), 2);
+    QVERIFY(provider->moveMedia(0, 2));
+    QCOMPARE(control->currentIndex(), 4);
+    QCOMPARE(indexSpy.count(), 2);
+    QCOMPARE(service.getPlayer()->trackList()->currentTrack(), 4);
+}
+
+void tst_MediaPlaylistControl::chunkedLoad()
+{
+    AalMediaPlayerService service;
+    service.requestControl(QMediaPlaylistControl_iid);
+    AalMediaPlaylistControl *control = service.mediaPlaylistControl();
+    AalMediaPlaylistProvider *provider =
+        static_cast<AalMediaPlaylistProvider*>(control->playlistProvider());
+    TrackList *trackList = service.getPlayer()->trackList();
+
+    QSignalSpy insertedSpy(provider, &QMediaPlaylistProvider::mediaInserted);
+    QList<QMediaContent> expected = makeTracks(250);
+    provider->addMedia(expected);
+
+    // The playlist has every track right away, media-hub gets the first chunk
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.at(0).at(0).toInt(), 0);
+    QCOMPARE(insertedSpy.at(0).at(1).toInt(), 249);
+    QCOMPARE(provider->mediaCount(), 250);
+    QVERIFY(provider->isLoading());
+    QCOMPARE(trackList->tracks().count(), 100);
+    QCOMPARE(provider->media(200), expected[200]);
+
+    // Indices refer to the whole playlist while it loads
+    control->setCurrentIndex(150);
+    QCOMPARE(trackList->currentTrack(), 0);
+
+    const QMediaContent extra(QUrl(QStringLiteral("file:///extra.ogg")));
+    QVERIFY(provider->insertMedia(120, extra));
+    expected.insert(120, extra);
+    QVERIFY(provider->removeMedia(10));
+    expected.removeAt(10);
+    QVERIFY(provider->moveMedia(5, 200));
+    expected.move(5, 200);
+    QCOMPARE(provider->mediaCount(), 250);
+
+    QTRY_VERIFY(!provider->isLoading());
+    QCOMPARE(trackList->tracks().count(), 250);
+    for (int i = 0; i < expected.count(); ++i)
+        QCOMPARE(provider->media(i), expected[i]);
+
+    // The track made current stayed current through the edits
+    QTRY_COMPARE(control->currentIndex(), trackList->currentTrack());
+    QCOMPARE(provider->media(control->currentIndex()), makeTracks(250)[150]);
+    QCOMPARE(insertedSpy.count(), 2);
+}
+
+void tst_MediaPlaylistControl::chunkedLoadProgress()
+{
+    AalMediaPlayerService service;
+    service.requestControl(QMediaPlaylistControl_iid);
+    AalMediaPlaylistControl *control = service.mediaPlaylistControl();
+    AalMediaPlaylistProvider *provider =
+        static_cast<AalMediaPlaylistProvider*>(control->playlistProvider());
+
+    // Once per chunk media-hub has, and through the control for the app
+    QSignalSpy providerSpy(provider, &AalMediaPlaylistProvider::loadProgress);
+    QSignalSpy progressSpy(control, &AalMediaPlaylistControl::loadProgress);
+    provider->addMedia(makeTracks(250));
+    QCOMPARE(progressSpy.count(), 1);
+    QCOMPARE(progressSpy.at(0).at(0).toInt(), 100);
+    QCOMPARE(progressSpy.at(0).at(1).toInt(), 250);
+
+    QTRY_VERIFY(!provider->isLoading());
+    QCOMPARE(progressSpy.count(), 3);
+    QCOMPARE(progressSpy.at(1).at(0).toInt(), 200);
+    QCOMPARE(progressSpy.at(2).at(0).toInt(), 250);
+    QCOMPARE(progressSpy.at(2).at(1).toInt(), 250);
+    QCOMPARE(providerSpy.count(), progressSpy.count());
+
+    // Tracks added one at a time aren't a load
+    provider->addMedia(makeTracks(1));
+    QCoreApplication::processEvents();
+    QCOMPARE(progressSpy.count(), 3);
+}
+
+void tst_MediaPlaylistControl::chunkedLoadStall()
+{
+    AalMediaPlayerService service;
+    service.requestControl(QMediaPlaylistControl_iid);
+    AalMediaPlaylistControl *control = service.mediaPlaylistControl();
+    AalMediaPlaylistProvider *provider =
+        static_cast<AalMediaPlaylistProvider*>(control->playlistProvider());
+    TrackList *trackList = service.getPlayer()->trackList();
+
+    // media-hub takes the first chunk but never reports it
+    trackList->blockSignals(true);
+    QSignalSpy removedSpy(provider, &QMediaPlaylistProvider::mediaRemoved);
+    provider->addMedia(makeTracks(250));
+    QCOMPARE(provider->mediaCount(), 250);
+
+    // The rest of the load is given up rather than waited for forever
+    QTRY_VERIFY_WITH_TIMEOUT(!provider->isLoading(), 10000);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(removedSpy.at(0).at(0).toInt(), 100);
+    QCOMPARE(removedSpy.at(0).at(1).toInt(), 249);
+    QCOMPARE(provider->mediaCount(), 100);
+    trackList->blockSignals(false);
+}
+
+void tst_MediaPlaylistControl::withoutPlayerSession()
+{
+    AalMediaPlayerService service;
+    service.requestControl(QMediaPlaylistControl_iid);
+    AalMediaPlaylistControl *control = service.mediaPlaylistControl();
+    QMediaPlaylistProvider *provider = control->playlistProvider();
+    provider->addMedia(makeTracks(3));
+    control->setCurrentIndex(2);
+    QCOMPARE(control->currentIndex(), 2);
+
+    // Like while the session is detached or media-hub is restarting, with
+    // tracks the app still sees
+    control->setPlayerSession(nullptr);
+    FixedPlaylistProvider tracks(3);
+    control->setPlaylistProvider(&tracks);
+
+    // The mode is kept until there is a session to give it to
+    QSignalSpy modeSpy(control, &AalMediaPlaylistControl::playbackModeChanged);
+    QCOMPARE(control->playbackMode(), QMediaPlaylist::Sequential);
+    control->setPlaybackMode(QMediaPlaylist::Random);
+    QCOMPARE(modeSpy.count(), 1);
+    QCOMPARE(control->playbackMode(), QMediaPlaylist::Random);
+
+    // Tracks media-hub would have to pick are not picked at all
+    control->next();
+    QCOMPARE(control->currentIndex(), 2);
+    control->previous();
+    QCOMPARE(control->currentIndex(), 2);
+    QCOMPARE(control->pendingSkip(), -1);
+
+    // Removing the current track at the end doesn't try to stop playback
+    control->setPlaybackMode(QMediaPlaylist::Sequential);
+    QVERIFY(QMetaObject::invokeMethod(control, "onRemoveTracks",
+                                      Q_ARG(int, 1), Q_ARG(int, 2)));
+    QCOMPARE(control->currentIndex(), 0);
+
+    control->setPlaylistProvider(provider);
+    control->setPlayerSession(service.getPlayer());
+    control->applyPendingPlaybackMode();
+    QCOMPARE(modeSpy.count(), 3);
+    control->applyPendingPlaybackMode();
+    QCOMPARE(modeSpy.count(), 3);
+}
+
 QMediaPlaylistControl* tst_MediaPlaylistControl::playlistControl()
 {
     return static_cast<QMediaPlaylistControl*>(m_mediaPlaylistControl);
@@ -51,6 +51,13 @@ private Q_SLOTS:
 
     void construction();
     void setAndVerifyCurrentIndex();
+    void currentIndexAfterEdits();
+    void moveTracks();
+    void chunkedLoad();
+    void chunkedLoadProgress();
+    void chunkedLoadStall();
+    void withoutPlayerSession();
+    void optimisticSkip();
 
 private:
     QMediaPlaylistControl* playlistControl();
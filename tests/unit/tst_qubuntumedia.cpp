@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "player.h"
+#include "aalmediaplayerservice.h"
+#include "aalmediaplaylistcontrol.h"
+#include "aalmediaplaylistprovider.h"
+#include "aalvideorenderercontrol.h"
+#include "playlistsnapshot.h"
+#include "tst_qubuntumedia.h"
+
+#include <MediaHub/Track>
+#include <MediaHub/TrackList>
+
+#include <QDataStream>
+#include <QFile>
+#include <QMediaObject>
+#include <QMediaPlayer>
+#include <QMediaPlaylist>
+#include <QVideoRendererControl>
+#include <QtTest/QtTest>
+
+#define private public
+#include "qubuntumedia.h"
+#undef private
+
+using namespace lomiri::MediaHub;
+
+namespace {
+
+// Lets a QMediaPlaylist use the service directly, the way QMediaPlayer
+// would with the plugin loaded
+class ServiceObject : public QMediaObject
+{
+public:
+    ServiceObject(QMediaService *service): QMediaObject(nullptr, service) {}
+};
+
+QList<QUrl> makeUrls(int count)
+{
+    QList<QUrl> urls;
+    for (int i = 0; i < count; ++i)
+        urls.append(QUrl(QStringLiteral("file:///music/track %1 #1.ogg").arg(i)));
+    return urls;
+}
+
+// Short names for the tracks of a playlist, e.g. "abc"
+QList<QUrl> urls(const QString &names)
+{
+    QList<QUrl> result;
+    Q_FOREACH(const QChar &name, names)
+        result.append(QUrl(QStringLiteral("file:///%1.ogg").arg(name)));
+    return result;
+}
+
+QList<QUrl> playlistUrls(const QMediaPlaylist *playlist)
+{
+    QList<QUrl> result;
+    for (int i = 0; i < playlist->mediaCount(); ++i)
+        result.append(playlist->media(i).canonicalUrl());
+    return result;
+}
+
+void writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QCOMPARE(file.write(data), qint64(data.size()));
+}
+
+QByteArray header(quint32 magic, quint16 version)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << magic << version;
+    return data;
+}
+
+} // namespace
+
+void tst_QUbuntuMedia::init()
+{
+    m_dir = new QTemporaryDir;
+    QVERIFY(m_dir->isValid());
+
+    // Stands in for the QML MediaPlayer item, which hands out its QMediaPlayer
+    // as the mediaObject property
+    m_player = new QMediaPlayer(this);
+    m_playerItem = new QObject(this);
+    m_playerItem->setProperty("mediaObject", QVariant::fromValue<QObject*>(m_player));
+
+    m_media = new QUbuntuMedia(this);
+    m_media->setMediaPlayer(m_playerItem);
+    QCOMPARE(m_media->mediaPlayer(), static_cast<QObject*>(m_player));
+}
+
+void tst_QUbuntuMedia::cleanup()
+{
+    delete m_media;
+    delete m_playerItem;
+    delete m_player;
+    delete m_dir;
+}
+
+QString tst_QUbuntuMedia::snapshotPath() const
+{
+    return m_dir->path() + QStringLiteral("/queue.snapshot");
+}
+
+void tst_QUbuntuMedia::snapshotRoundTrip()
+{
+    PlaylistSnapshot saved;
+    saved.urls = makeUrls(50);
+    saved.urls.append(QUrl(QStringLiteral("http://example.com/stream?id=1&name=a%20b")));
+    saved.currentIndex = 17;
+    saved.position = Q_INT64_C(5000000000);
+    saved.playbackMode = QMediaPlaylist::Random;
+    QVERIFY(saved.save(snapshotPath()));
+
+    PlaylistSnapshot loaded;
+    QVERIFY(loaded.load(snapshotPath()));
+    QCOMPARE(loaded.urls, saved.urls);
+    QCOMPARE(loaded.currentIndex, saved.currentIndex);
+    QCOMPARE(loaded.position, saved.position);
+    QCOMPARE(loaded.playbackMode, saved.playbackMode);
+
+    // An empty queue is a valid snapshot too
+    PlaylistSnapshot empty;
+    QVERIFY(empty.save(snapshotPath()));
+    QVERIFY(loaded.load(snapshotPath()));
+    QVERIFY(loaded.urls.isEmpty());
+    QCOMPARE(loaded.currentIndex, 0);
+    QCOMPARE(loaded.position, qint64(0));
+}
+
+void tst_QUbuntuMedia::snapshotCorrupt_data()
+{
+    QTest::addColumn<QByteArray>("data");
+
+    // Runs before init(), so it needs a directory of its own
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    PlaylistSnapshot valid;
+    valid.urls = makeUrls(3);
+    valid.currentIndex = 1;
+    const QString validPath = dir.path() + QStringLiteral("/valid.snapshot");
+    QVERIFY(valid.save(validPath));
+    QFile file(validPath);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray bytes = file.readAll();
+
+    QByteArray hugeCount = header(PlaylistSnapshot::Magic, PlaylistSnapshot::Version);
+    {
+        QDataStream out(&hugeCount, QIODevice::WriteOnly | QIODevice::Append);
+        out.setVersion(QDataStream::Qt_5_0);
+        out << qint32(0) << qint64(0) << qint32(0) << quint32(0xffffffff);
+    }
+
+    QTest::newRow("empty") << QByteArray();
+    QTest::newRow("garbage") << QByteArray("this is not a playlist snapshot at all");
+    QTest::newRow("header only") << header(PlaylistSnapshot::Magic, PlaylistSnapshot::Version);
+    QTest::newRow("truncated in a track") << bytes.left(bytes.size() - 5);
+    QTest::newRow("count beyond the data") << hugeCount;
+}
+
+void tst_QUbuntuMedia::snapshotCorrupt()
+{
+    QFETCH(QByteArray, data);
+    writeFile(snapshotPath(), data);
+
+    // A failed load leaves the snapshot as it was
+    PlaylistSnapshot snapshot;
+    snapshot.urls = makeUrls(1);
+    snapshot.currentIndex = 7;
+    QVERIFY(!snapshot.load(snapshotPath()));
+    QCOMPARE(snapshot.urls, makeUrls(1));
+    QCOMPARE(snapshot.currentIndex, 7);
+
+    QVERIFY(!m_media->restoreSnapshot(snapshotPath()));
+    QVERIFY(m_media->playlist().isEmpty());
+}
+
+void tst_QUbuntuMedia::snapshotVersion()
+{
+    PlaylistSnapshot snapshot;
+    QVERIFY(!snapshot.load(m_dir->path() + QStringLiteral("/missing.snapshot")));
+
+    // The version is written right after the magic
+    QVERIFY(snapshot.save(snapshotPath()));
+    QFile file(snapshotPath());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.read(6), header(PlaylistSnapshot::Magic, PlaylistSnapshot::Version));
+    file.close();
+
+    // A snapshot from a newer release isn't guessed at
+    writeFile(snapshotPath(), header(PlaylistSnapshot::Magic, PlaylistSnapshot::Version + 1)
+              + QByteArray(64, '\0'));
+    QVERIFY(!snapshot.load(snapshotPath()));
+
+    writeFile(snapshotPath(), header(PlaylistSnapshot::Magic + 1, PlaylistSnapshot::Version)
+              + QByteArray(64, '\0'));
+    QVERIFY(!snapshot.load(snapshotPath()));
+}
+
+void tst_QUbuntuMedia::restoreWaitsForLoadedMedia()
+{
+    PlaylistSnapshot saved;
+    saved.urls = makeUrls(3);
+    saved.currentIndex = 2;
+    saved.position = 5000;
+    saved.playbackMode = QMediaPlaylist::Loop;
+    QVERIFY(saved.save(snapshotPath()));
+
+    QSignalSpy playlistSpy(m_media, &QUbuntuMedia::playlistChanged);
+    QVERIFY(m_media->restoreSnapshot(snapshotPath()));
+    QCOMPARE(playlistSpy.count(), 1);
+    QCOMPARE(m_media->playlist(), saved.urls);
+    QCOMPARE(m_media->m_mediaPlaylist->mediaCount(), 3);
+    QCOMPARE(m_media->m_mediaPlaylist->playbackMode(), QMediaPlaylist::Loop);
+
+    // Nothing is moved until the player has loaded the queue
+    QVERIFY(m_media->m_mediaPlaylist->currentIndex() != 2);
+    QCOMPARE(m_media->m_restoreIndex, 2);
+
+    // and saving meanwhile keeps where the restore is headed
+    const QString againPath = m_dir->path() + QStringLiteral("/again.snapshot");
+    QVERIFY(m_media->saveSnapshot(againPath));
+    PlaylistSnapshot again;
+    QVERIFY(again.load(againPath));
+    QCOMPARE(again.urls, saved.urls);
+    QCOMPARE(again.currentIndex, 2);
+    QCOMPARE(again.position, qint64(5000));
+    QCOMPARE(again.playbackMode, int(QMediaPlaylist::Loop));
+
+    Q_EMIT m_player->mediaStatusChanged(QMediaPlayer::LoadingMedia);
+    QCOMPARE(m_media->m_restoreIndex, 2);
+
+    Q_EMIT m_player->mediaStatusChanged(QMediaPlayer::LoadedMedia);
+    QCOMPARE(m_media->m_mediaPlaylist->currentIndex(), 2);
+    QCOMPARE(m_media->m_restoreIndex, -1);
+
+    // Only once
+    m_media->m_mediaPlaylist->setCurrentIndex(0);
+    Q_EMIT m_player->mediaStatusChanged(QMediaPlayer::BufferedMedia);
+    QCOMPARE(m_media->m_mediaPlaylist->currentIndex(), 0);
+}
+
+void tst_QUbuntuMedia::restoreInvalidMedia()
+{
+    PlaylistSnapshot saved;
+    saved.urls = makeUrls(3);
+    saved.currentIndex = 2;
+    QVERIFY(saved.save(snapshotPath()));
+
+    QVERIFY(m_media->restoreSnapshot(snapshotPath()));
+    QCOMPARE(m_media->m_restoreIndex, 2);
+
+    Q_EMIT m_player->mediaStatusChanged(QMediaPlayer::InvalidMedia);
+    QCOMPARE(m_media->m_restoreIndex, -1);
+
+    Q_EMIT m_player->mediaStatusChanged(QMediaPlayer::LoadedMedia);
+    QVERIFY(m_media->m_mediaPlaylist->currentIndex() != 2);
+}
+
+void tst_QUbuntuMedia::playlistEdits_data()
+{
+    QTest::addColumn<QList<QUrl>>("from");
+    QTest::addColumn<QList<QUrl>>("to");
+    // -1 where the exact operations don't matter
+    QTest::addColumn<int>("insertions");
+    QTest::addColumn<int>("removals");
+
+    QTest::newRow("append") << urls("abc") << urls("abcde") << 1 << 0;
+    QTest::newRow("prepend") << urls("abc") << urls("xabc") << 1 << 0;
+    QTest::newRow("insert") << urls("abc") << urls("axybc") << 1 << 0;
+    QTest::newRow("remove") << urls("abcd") << urls("ad") << 0 << 1;
+    QTest::newRow("remove tail") << urls("abcd") << urls("ab") << 0 << 1;
+    QTest::newRow("remove head") << urls("abcd") << urls("cd") << 0 << 1;
+    QTest::newRow("replace") << urls("abcd") << urls("axyzd") << 1 << 1;
+    QTest::newRow("replace all") << urls("ab") << urls("xyz") << 1 << 1;
+    QTest::newRow("move up") << urls("abcde") << urls("adbce") << 0 << 0;
+    QTest::newRow("move down") << urls("abcde") << urls("acdbe") << 0 << 0;
+    QTest::newRow("move to front") << urls("abcd") << urls("dabc") << 0 << 0;
+    QTest::newRow("move to end") << urls("abcd") << urls("bcda") << 0 << 0;
+    QTest::newRow("swap") << urls("abcd") << urls("dbca") << -1 << -1;
+    QTest::newRow("reverse") << urls("abcde") << urls("edcba") << -1 << -1;
+    QTest::newRow("duplicates") << urls("aab") << urls("aba") << -1 << -1;
+    QTest::newRow("insert and remove") << urls("abcdef") << urls("xbcdy") << -1 << -1;
+}
+
+void tst_QUbuntuMedia::playlistEdits()
+{
+    QFETCH(QList<QUrl>, from);
+    QFETCH(QList<QUrl>, to);
+    QFETCH(int, insertions);
+    QFETCH(int, removals);
+
+    m_media->setPlaylist(from, 0);
+    QCOMPARE(playlistUrls(m_media->m_mediaPlaylist), from);
+
+    QSignalSpy insertedSpy(m_media->m_mediaPlaylist, &QMediaPlaylist::mediaInserted);
+    QSignalSpy removedSpy(m_media->m_mediaPlaylist, &QMediaPlaylist::mediaRemoved);
+    QSignalSpy playlistSpy(m_media, &QUbuntuMedia::playlistChanged);
+
+    m_media->setPlaylist(to, 0);
+    QCOMPARE(playlistSpy.count(), 1);
+    QCOMPARE(m_media->playlist(), to);
+    QCOMPARE(playlistUrls(m_media->m_mediaPlaylist), to);
+    if (insertions >= 0)
+        QCOMPARE(insertedSpy.count(), insertions);
+    if (removals >= 0)
+        QCOMPARE(removedSpy.count(), removals);
+
+    // Setting the same list again touches nothing
+    m_media->setPlaylist(to, 0);
+    QCOMPARE(playlistSpy.count(), 1);
+}
+
+void tst_QUbuntuMedia::movePlayingTrackDown()
+{
+    AalMediaPlayerService service;
+    ServiceObject serviceObject(&service);
+    QMediaPlaylist *playlist = new QMediaPlaylist;
+    QVERIFY(serviceObject.bind(playlist));
+    TrackList *trackList = service.getPlayer()->trackList();
+
+    QMediaPlaylist *unbound = m_media->m_mediaPlaylist;
+    m_media->m_mediaPlaylist = playlist;
+
+    m_media->setPlaylist(urls("abcde"), 1);
+    QCOMPARE(trackList->currentTrack(), 1);
+
+    // The playing track is moved in media-hub, not taken out and put back
+    QSignalSpy removedSpy(trackList, &TrackList::trackRemoved);
+    QSignalSpy addedSpy(trackList, &TrackList::tracksAdded);
+    QSignalSpy currentSpy(trackList, &TrackList::currentTrackChanged);
+    m_media->setPlaylist(urls("acdbe"), 3);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(addedSpy.count(), 0);
+    QCOMPARE(currentSpy.count(), 0);
+    QCOMPARE(trackList->currentTrack(), 3);
+    QTRY_COMPARE(playlist->currentIndex(), 3);
+    QCOMPARE(playlistUrls(playlist), urls("acdbe"));
+    QCOMPARE(trackList->tracks().at(3).uri(), urls("b").first());
+
+    m_media->m_mediaPlaylist = unbound;
+    delete playlist;
+}
+
+void tst_QUbuntuMedia::playlistEditsDuringLoad()
+{
+    // The edits go to the media-hub track list while it is still being
+    // handed the first list in chunks
+    AalMediaPlayerService service;
+    ServiceObject serviceObject(&service);
+    QMediaPlaylist *playlist = new QMediaPlaylist;
+    QVERIFY(serviceObject.bind(playlist));
+    AalMediaPlaylistProvider *provider =
+        static_cast<AalMediaPlaylistProvider*>(service.mediaPlaylistControl()->playlistProvider());
+    TrackList *trackList = service.getPlayer()->trackList();
+
+    QMediaPlaylist *unbound = m_media->m_mediaPlaylist;
+    m_media->m_mediaPlaylist = playlist;
+
+    const QList<QUrl> from = makeUrls(250);
+    m_media->setPlaylist(from, 0);
+    QVERIFY(provider->isLoading());
+    QCOMPARE(playlist->mediaCount(), 250);
+
+    QList<QUrl> to = from;
+    to.insert(120, QUrl(QStringLiteral("file:///extra.ogg")));
+    m_media->setPlaylist(to, 0);
+    to.removeAt(10);
+    m_media->setPlaylist(to, 0);
+    to.move(200, 5);
+    m_media->setPlaylist(to, 0);
+    to.move(3, 220);
+    m_media->setPlaylist(to, 0);
+    to = to.mid(0, 240) + urls("xyz");
+    m_media->setPlaylist(to, 0);
+    QVERIFY(provider->isLoading());
+    QCOMPARE(playlistUrls(playlist), to);
+
+    QTRY_VERIFY(!provider->isLoading());
+    QCOMPARE(playlistUrls(playlist), to);
+    const QVector<Track> tracks = trackList->tracks();
+    QCOMPARE(tracks.count(), to.count());
+    for (int i = 0; i < tracks.count(); ++i)
+        QCOMPARE(tracks[i].uri(), to[i]);
+
+    m_media->m_mediaPlaylist = unbound;
+    delete playlist;
+}
+
+void tst_QUbuntuMedia::loadProgress()
+{
+    AalMediaPlayerService service;
+    ServiceObject serviceObject(&service);
+    QMediaPlaylist *playlist = new QMediaPlaylist;
+    QVERIFY(serviceObject.bind(playlist));
+
+    QMediaPlaylist *unbound = m_media->m_mediaPlaylist;
+    m_media->m_mediaPlaylist = playlist;
+
+    // Forwarded from the playlist control, chunk by chunk
+    QSignalSpy progressSpy(m_media, &QUbuntuMedia::loadProgress);
+    m_media->setPlaylist(makeUrls(250), 0);
+    QCOMPARE(progressSpy.count(), 1);
+    QCOMPARE(progressSpy.at(0).at(0).toInt(), 100);
+    QCOMPARE(progressSpy.at(0).at(1).toInt(), 250);
+    QTRY_COMPARE(progressSpy.count(), 3);
+    QCOMPARE(progressSpy.last().at(0).toInt(), 250);
+    QCOMPARE(progressSpy.last().at(1).toInt(), 250);
+
+    // Appending another long list is a load of its own, reported once
+    m_media->setPlaylist(makeUrls(500), 0);
+    QTRY_COMPARE(progressSpy.count(), 6);
+    QCOMPARE(progressSpy.at(3).at(0).toInt(), 100);
+    QCOMPARE(progressSpy.last().at(0).toInt(), 250);
+    QCOMPARE(progressSpy.last().at(1).toInt(), 250);
+    QTest::qWait(50);
+    QCOMPARE(progressSpy.count(), 6);
+
+    m_media->m_mediaPlaylist = unbound;
+    delete playlist;
+}
+
+void tst_QUbuntuMedia::videoVisible()
+{
+    QVERIFY(m_media->property("videoVisible").toBool());
+
+    QSignalSpy visibleSpy(m_media, &QUbuntuMedia::videoVisibleChanged);
+    QVERIFY(m_media->setProperty("videoVisible", false));
+    QCOMPARE(visibleSpy.count(), 1);
+    QVERIFY(!m_media->videoVisible());
+    m_media->setVideoVisible(false);
+    QCOMPARE(visibleSpy.count(), 1);
+
+    // A player without video doesn't get a renderer just to hide it
+    Q_EMIT m_player->videoAvailableChanged(false);
+    QVERIFY(!m_media->m_videoVisibleForwarded);
+
+    QVERIFY(m_media->setProperty("videoVisible", true));
+    QCOMPARE(visibleSpy.count(), 2);
+    QVERIFY(m_media->videoVisible());
+    QVERIFY(!m_media->m_videoVisibleForwarded);
+
+    // The flag is handed over by name, see QUbuntuMedia::applyVideoVisible()
+    AalMediaPlayerService service;
+    AalVideoRendererControl *renderer = static_cast<AalVideoRendererControl*>(
+            service.requestControl(QVideoRendererControl_iid));
+    QVERIFY(renderer != nullptr);
+    QVERIFY(renderer->isVisible());
+    QVERIFY(QMetaObject::invokeMethod(renderer, "setVisible", Q_ARG(bool, false)));
+    QVERIFY(!renderer->isVisible());
+    QVERIFY(QMetaObject::invokeMethod(renderer, "setVisible", Q_ARG(bool, true)));
+    QVERIFY(renderer->isVisible());
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TST_QUBUNTUMEDIA_H
+#define TST_QUBUNTUMEDIA_H
+
+#include <QObject>
+#include <QTemporaryDir>
+
+class QMediaPlayer;
+class QUbuntuMedia;
+
+class tst_QUbuntuMedia : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir *m_dir;
+    QMediaPlayer *m_player;
+    QObject *m_playerItem;
+    QUbuntuMedia *m_media;
+
+private Q_SLOTS:
+    // We want the setup to be run prior to every test case to
+    // ensure correct test isolation, see http://qt-project.org/doc/qt-5/qtest-overview.html.
+    void init();
+    void cleanup();
+
+    void snapshotRoundTrip();
+    void snapshotCorrupt_data();
+    void snapshotCorrupt();
+    void snapshotVersion();
+    void restoreWaitsForLoadedMedia();
+    void restoreInvalidMedia();
+    void playlistEdits_data();
+    void playlistEdits();
+    void movePlayingTrackDown();
+    void playlistEditsDuringLoad();
+    void loadProgress();
+    void videoVisible();
+
+private:
+    QString snapshotPath() const;
+};
+
+#endif // TST_QUBUNTUMEDIA_H
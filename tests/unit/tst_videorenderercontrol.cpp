@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "player.h"
+#include "aalbackendwatchdog.h"
+#include "aalmediaplayerservice.h"
+#include "aalsharedsignalrouter.h"
+#include "aalvideorenderercontrol.h"
+#include "offscreenvideosurface.h"
+#include "softwarevideosink.h"
+#include "tst_videorenderercontrol.h"
+
+#include <qtubuntu_media_signals.h>
+
+#include <QVideoSurfaceFormat>
+#include <QtTest/QtTest>
+
+using namespace lomiri::MediaHub;
+
+void tst_VideoRendererControl::init()
+{
+    m_service = new AalMediaPlayerService(this);
+    m_renderer = static_cast<AalVideoRendererControl*>(
+            m_service->requestControl(QVideoRendererControl_iid));
+    QVERIFY(m_renderer != nullptr);
+
+    m_surface = new OffscreenVideoSurface(QAbstractVideoBuffer::GLTextureHandle, this);
+    m_renderer->setSurface(m_surface);
+}
+
+void tst_VideoRendererControl::cleanup()
+{
+    delete m_service;
+    delete m_surface;
+}
+
+void tst_VideoRendererControl::framesAreRecycled()
+{
+    startRendering();
+
+    // The surface holds on to the last frame while the next one is built,
+    // so steady state takes turns between two buffers
+    presentFrame();
+
+    const int framesToPresent = 1000;
+    const int presentedBefore = m_surface->presentedFrames();
+    const quint64 allocationsBefore = m_renderer->frameAllocations();
+
+    for (int i = 0; i < framesToPresent; ++i)
+        presentFrame();
+
+    QCOMPARE(m_surface->presentedFrames() - presentedBefore, framesToPresent);
+
+    const quint64 allocations = m_renderer->frameAllocations() - allocationsBefore;
+    qDebug() << "Frame allocations per presented frame:"
+             << double(allocations) / framesToPresent;
+    QCOMPARE(allocations, quint64(0));
+
+    // Only the buffers are recycled, every present gets a frame of its own
+    QVideoFrame shown = m_surface->lastFrame();
+    shown.setMetaData(QStringLiteral("Shown"), true);
+    presentFrame();
+    QVERIFY(m_surface->lastFrame() != shown);
+    QVERIFY(!m_surface->lastFrame().metaData(QStringLiteral("Shown")).isValid());
+}
+
+void tst_VideoRendererControl::benchmarkPresentFrame()
+{
+    startRendering();
+
+    QBENCHMARK {
+        presentFrame();
+    }
+}
+
+void tst_VideoRendererControl::mappedFramesForSoftwareSurface()
+{
+    OffscreenVideoSurface softwareSurface(QAbstractVideoBuffer::NoHandle);
+    m_renderer->setSurface(&softwareSurface);
+
+    // No texture handshake for surfaces without GL support
+    m_renderer->setupSurface();
+    Q_EMIT m_service->getPlayer()->videoDimensionChanged(QSize(320, 240));
+    QCOMPARE(m_renderer->textureId(), GLuint(0));
+
+    const quint64 allocationsBefore = m_renderer->frameAllocations();
+    for (int i = 0; i < 100; ++i)
+        presentFrame();
+
+    QCOMPARE(softwareSurface.presentedFrames(), 100);
+    // The surface keeps the last frame, so at most two buffers are in flight
+    QVERIFY(m_renderer->frameAllocations() - allocationsBefore <= 2);
+
+    QVideoFrame frame = softwareSurface.lastFrame();
+    QCOMPARE(frame.handleType(), QAbstractVideoBuffer::NoHandle);
+    QCOMPARE(frame.pixelFormat(), QVideoFrame::Format_NV12);
+    QCOMPARE(frame.size(), QSize(320, 240));
+
+    QVERIFY(frame.map(QAbstractVideoBuffer::ReadOnly));
+    QCOMPARE(frame.mappedBytes(), 320 * 240 * 3 / 2);
+    QCOMPARE(frame.bytesPerLine(), 320);
+    // SoftwareVideoSink fills frame n with n % 256, the first one being 0
+    QCOMPARE(int(frame.bits()[0]), 99);
+    frame.unmap();
+
+    m_renderer->setSurface(m_surface);
+}
+
+void tst_VideoRendererControl::noMappedSinkWithoutSupport()
+{
+    // Like media-hub, whose sinks only render to GL textures
+    m_service->getPlayer()->setProperty("mappableVideoSinks", false);
+    QVERIFY(!m_service->canMapVideoFrames());
+
+    OffscreenVideoSurface softwareSurface(QAbstractVideoBuffer::NoHandle);
+    m_renderer->setSurface(&softwareSurface);
+
+    // The renderer falls back to GL textures without creating a sink first
+    AalBackendWatchdog *watchdog = AalBackendWatchdog::instance();
+    const qint64 budget = watchdog->budgetUs();
+    watchdog->clear();
+    watchdog->setBudgetUs(-1);
+    m_renderer->setupSurface();
+    watchdog->setBudgetUs(budget);
+    for (const AalBackendCall &call : watchdog->slowCalls())
+        QVERIFY2(qstrcmp(call.call, "Player::createGLTextureVideoSink") != 0, call.call);
+    watchdog->clear();
+
+    m_renderer->setSurface(m_surface);
+}
+
+void tst_VideoRendererControl::framePacing_data()
+{
+    QTest::addColumn<qreal>("framesPerSecond");
+
+    QTest::newRow("30 fps") << qreal(30);
+    QTest::newRow("60 fps") << qreal(60);
+}
+
+void tst_VideoRendererControl::framePacing()
+{
+    QFETCH(qreal, framesPerSecond);
+    const int framesToPresent = 30;
+
+    startRendering();
+
+    SoftwareVideoSink &sink = static_cast<SoftwareVideoSink&>(
+            m_service->getPlayer()->createGLTextureVideoSink(m_renderer->textureId()));
+    const int firstPresent = m_surface->presentedFrames();
+
+    // Goes through onFrameAvailable() and the queued updateVideoTexture()
+    // exactly like frames decoded by media-hub
+    sink.start(framesPerSecond);
+    QTRY_VERIFY_WITH_TIMEOUT(m_surface->presentedFrames() - firstPresent >= framesToPresent, 5000);
+    sink.stop();
+
+    const QVector<qint64> &frameTimes = sink.frameTimes();
+    const QVector<qint64> &presentTimes = m_surface->presentTimes();
+
+    qint64 maxLatency = 0, maxInterval = 0, totalInterval = 0;
+    for (int i = 0; i < framesToPresent; ++i) {
+        const qint64 presentTime = presentTimes[firstPresent + i];
+        maxLatency = qMax(maxLatency, presentTime - frameTimes[i]);
+        if (i > 0) {
+            const qint64 interval = presentTime - presentTimes[firstPresent + i - 1];
+            maxInterval = qMax(maxInterval, interval);
+            totalInterval += interval;
+        }
+    }
+
+    const qreal frameIntervalMs = 1000 / framesPerSecond;
+    qDebug() << "Frame interval (ms): expected" << frameIntervalMs
+             << "average" << totalInterval / 1e6 / (framesToPresent - 1)
+             << "max" << maxInterval / 1e6;
+    qDebug() << "Frame available to present latency, max (ms):" << maxLatency / 1e6;
+
+    // Loose bounds, these are meant to catch regressions like frames being
+    // presented late by whole frame periods, not scheduler jitter
+    QVERIFY(maxLatency / 1e6 < 2 * frameIntervalMs);
+    QVERIFY(maxInterval / 1e6 < 3 * frameIntervalMs);
+}
+
+void tst_VideoRendererControl::resolutionChangeKeepsSink()
+{
+    startRendering();
+    presentFrame();
+    QCOMPARE(m_surface->surfaceFormat().frameSize(), QSize(1280, 720));
+
+    const int startCount = m_surface->startCount();
+    presentFrame();
+    QCOMPARE(m_surface->startCount(), startCount);
+
+    // A bitrate switch of an adaptive stream
+    Q_EMIT m_service->getPlayer()->videoDimensionChanged(QSize(640, 360));
+    presentFrame();
+
+    QCOMPARE(m_surface->startCount(), startCount + 1);
+    QVERIFY(m_surface->isActive());
+    QCOMPARE(m_surface->surfaceFormat().frameSize(), QSize(640, 360));
+    QCOMPARE(m_surface->lastFrame().size(), QSize(640, 360));
+    QCOMPARE(m_renderer->textureId(), GLuint(1));
+
+    presentFrame();
+    QCOMPARE(m_surface->startCount(), startCount + 1);
+}
+
+void tst_VideoRendererControl::replayKeepsTexture()
+{
+    QSignalSpy sinkResetSpy(SharedSignal::instance(), SIGNAL(sinkReset()));
+    startRendering();
+    presentFrame();
+
+    Q_EMIT m_service->getPlayer()->endOfStream();
+    QCOMPARE(sinkResetSpy.count(), 0);
+    QCOMPARE(m_renderer->textureId(), GLuint(1));
+
+    // Replaying goes straight to presenting frames of the same texture,
+    // no new textureCreated() from qtvideo-node is needed
+    const int presentedBefore = m_surface->presentedFrames();
+    m_service->play();
+    presentFrame();
+
+    QVERIFY(m_surface->presentedFrames() > presentedBefore);
+    QCOMPARE(m_surface->lastFrame().handle().toUInt(), 1u);
+    QCOMPARE(m_renderer->textureId(), GLuint(1));
+    QCOMPARE(sinkResetSpy.count(), 0);
+}
+
+void tst_VideoRendererControl::newMediaReleasesTexture()
+{
+    QSignalSpy sinkResetSpy(SharedSignal::instance(), SIGNAL(sinkReset()));
+    startRendering();
+
+    m_service->setMedia(QUrl("file:///tmp/other.mp4"), Player::Headers());
+    QCOMPARE(sinkResetSpy.count(), 1);
+    QCOMPARE(m_renderer->textureId(), GLuint(0));
+}
+
+void tst_VideoRendererControl::framesCarryTimestamps()
+{
+    startRendering();
+    VideoSink &sink = m_service->getPlayer()->createGLTextureVideoSink(m_renderer->textureId());
+    m_renderer->resetFrameTimingStats();
+
+    // Unknown stream position, nothing to stamp the frame with but the time
+    // it became available
+    const qint64 beforeAvailable = SoftwareVideoSink::steadyClockNs();
+    Q_EMIT sink.frameAvailable();
+    QTRY_VERIFY(m_surface->lastFrame().metaData("AvailableTime").toLongLong() >= beforeAvailable);
+    QCOMPARE(m_surface->lastFrame().startTime(), qint64(-1));
+    QCOMPARE(m_renderer->frameTimingStats().frames, quint64(0));
+
+    // The player is paused, so the stream clock doesn't move on between the
+    // frame becoming available and it being presented
+    Q_EMIT m_service->getPlayer()->seekedTo(5000000);
+    const int presentedBefore = m_surface->presentedFrames();
+    Q_EMIT sink.frameAvailable();
+    QTRY_COMPARE(m_surface->presentedFrames(), presentedBefore + 1);
+
+    QCOMPARE(m_surface->lastFrame().startTime(), qint64(5000000));
+    const AalFrameTimingStats stats = m_renderer->frameTimingStats();
+    QCOMPARE(stats.frames, quint64(1));
+    QCOMPARE(stats.lastDriftUs, qint64(0));
+    QCOMPARE(stats.averageDriftUs(), qint64(0));
+
+    // Stamping the next frame leaves the one the surface still has alone
+    const QVideoFrame shown = m_surface->lastFrame();
+    const qint64 shownAvailable = shown.metaData("AvailableTime").toLongLong();
+    Q_EMIT m_service->getPlayer()->seekedTo(9000000);
+    Q_EMIT sink.frameAvailable();
+    QTRY_COMPARE(m_surface->presentedFrames(), presentedBefore + 2);
+    QCOMPARE(m_surface->lastFrame().startTime(), qint64(9000000));
+    QCOMPARE(shown.startTime(), qint64(5000000));
+    QCOMPARE(shown.metaData("AvailableTime").toLongLong(), shownAvailable);
+}
+
+void tst_VideoRendererControl::texturesGoToWaitingRenderer()
+{
+    AalMediaPlayerService otherService;
+    AalVideoRendererControl *otherRenderer = static_cast<AalVideoRendererControl*>(
+            otherService.requestControl(QVideoRendererControl_iid));
+    OffscreenVideoSurface otherSurface;
+    otherRenderer->setSurface(&otherSurface);
+
+    // Nobody is waiting for a texture yet
+    Q_EMIT SharedSignal::instance()->textureCreated(6);
+    QCOMPARE(m_renderer->textureId(), GLuint(0));
+    QCOMPARE(otherRenderer->textureId(), GLuint(0));
+
+    // Texture requests are answered in the order the renderers made them
+    otherRenderer->setupSurface();
+    m_renderer->setupSurface();
+
+    Q_EMIT SharedSignal::instance()->textureCreated(7);
+    QCOMPARE(otherRenderer->textureId(), GLuint(7));
+    QCOMPARE(m_renderer->textureId(), GLuint(0));
+
+    Q_EMIT SharedSignal::instance()->textureCreated(8);
+    QCOMPARE(otherRenderer->textureId(), GLuint(7));
+    QCOMPARE(m_renderer->textureId(), GLuint(8));
+}
+
+void tst_VideoRendererControl::texturesFollowTheirFrame()
+{
+    // Goes away with the application instead of outliving it
+    QCOMPARE(AalSharedSignalRouter::instance()->parent(), QCoreApplication::instance());
+
+    AalMediaPlayerService otherService;
+    AalVideoRendererControl *otherRenderer = static_cast<AalVideoRendererControl*>(
+            otherService.requestControl(QVideoRendererControl_iid));
+    OffscreenVideoSurface otherSurface;
+    otherRenderer->setSurface(&otherSurface);
+
+    otherRenderer->setupSurface();
+    m_renderer->setupSurface();
+
+    // qtvideo-node gets to the later renderer's frame first, reading its
+    // handle right before answering it
+    m_surface->lastFrame().handle();
+    Q_EMIT SharedSignal::instance()->textureCreated(7);
+    QCOMPARE(m_renderer->textureId(), GLuint(7));
+    QCOMPARE(otherRenderer->textureId(), GLuint(0));
+
+    // Same for the frame handing over the sink
+    m_surface->lastFrame().handle();
+    QVERIFY(m_surface->lastFrame().metaData("GLVideoSink").isValid());
+    Q_EMIT SharedSignal::instance()->glConsumerSet();
+
+    // An answer without a frame read before it goes to whoever waited longest
+    Q_EMIT SharedSignal::instance()->textureCreated(8);
+    QCOMPARE(otherRenderer->textureId(), GLuint(8));
+    QCOMPARE(m_renderer->textureId(), GLuint(7));
+}
+
+void tst_VideoRendererControl::interleavedHandshakesSwapTextures()
+{
+    AalMediaPlayerService otherService;
+    AalVideoRendererControl *otherRenderer = static_cast<AalVideoRendererControl*>(
+            otherService.requestControl(QVideoRendererControl_iid));
+    OffscreenVideoSurface otherSurface;
+    otherRenderer->setSurface(&otherSurface);
+
+    otherRenderer->setupSurface();
+    m_renderer->setupSurface();
+
+    // Reading the second renderer's frame before answering the first one
+    // overwrites the token noted on this thread, so the answer for the
+    // first frame goes to the second renderer
+    otherSurface.lastFrame().handle();
+    m_surface->lastFrame().handle();
+    Q_EMIT SharedSignal::instance()->textureCreated(7);
+    QCOMPARE(m_renderer->textureId(), GLuint(7));
+    QCOMPARE(otherRenderer->textureId(), GLuint(0));
+
+    // The answer for the second frame comes without a token and goes to
+    // the renderer still waiting. Each ends up with the other's texture.
+    Q_EMIT SharedSignal::instance()->textureCreated(8);
+    QCOMPARE(otherRenderer->textureId(), GLuint(8));
+    QCOMPARE(m_renderer->textureId(), GLuint(7));
+}
+
+void tst_VideoRendererControl::noPresentWhileInvisible()
+{
+    // The texture handshake still happens while invisible
+    m_renderer->setVisible(false);
+    startRendering();
+
+    const int presentedBefore = m_surface->presentedFrames();
+    for (int i = 0; i < 10; ++i)
+        presentFrame();
+    QCOMPARE(m_surface->presentedFrames(), presentedBefore);
+
+    // The latest frame shows up without waiting for the next one
+    m_renderer->setVisible(true);
+    QCOMPARE(m_surface->presentedFrames(), presentedBefore + 1);
+    QCOMPARE(m_surface->lastFrame().handle().toUInt(), 1u);
+
+    presentFrame();
+    QCOMPARE(m_surface->presentedFrames(), presentedBefore + 2);
+
+    // Nothing was dropped, nothing to catch up with
+    m_renderer->setVisible(false);
+    m_renderer->setVisible(true);
+    QCOMPARE(m_surface->presentedFrames(), presentedBefore + 2);
+}
+
+void tst_VideoRendererControl::backgroundReleasesTexture()
+{
+    QSignalSpy sinkResetSpy(SharedSignal::instance(), SIGNAL(sinkReset()));
+    startRendering();
+
+    m_service->onApplicationStateChanged(Qt::ApplicationHidden);
+    m_service->onApplicationStateChanged(Qt::ApplicationSuspended);
+    QCOMPARE(sinkResetSpy.count(), 1);
+    QCOMPARE(m_renderer->textureId(), GLuint(0));
+
+    const int presentedBefore = m_surface->presentedFrames();
+    presentFrame();
+    QCOMPARE(m_surface->presentedFrames(), presentedBefore);
+
+    // The texture handshake starts as soon as the application is back
+    m_service->onApplicationStateChanged(Qt::ApplicationActive);
+    QCOMPARE(m_surface->presentedFrames(), presentedBefore + 1);
+
+    Q_EMIT SharedSignal::instance()->textureCreated(2);
+    QCOMPARE(m_renderer->textureId(), GLuint(2));
+    QCOMPARE(m_surface->presentedFrames(), presentedBefore + 2);
+
+    presentFrame();
+    QCOMPARE(m_surface->lastFrame().handle().toUInt(), 2u);
+}
+
+void tst_VideoRendererControl::startRendering()
+{
+    // Presents the first (empty) frame that makes qtvideo-node create a texture
+    m_renderer->setupSurface();
+    Q_EMIT m_service->getPlayer()->videoDimensionChanged(QSize(1280, 720));
+
+    // Stand in for qtvideo-node handing back the texture, which creates the
+    // video sink and presents the frame carrying it
+    Q_EMIT SharedSignal::instance()->textureCreated(1);
+    QCOMPARE(m_renderer->textureId(), GLuint(1));
+}
+
+void tst_VideoRendererControl::presentFrame()
+{
+    QMetaObject::invokeMethod(m_renderer, "updateVideoTexture", Qt::DirectConnection);
+}
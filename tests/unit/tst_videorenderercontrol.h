@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TST_VIDEORENDERERCONTROL_H
+#define TST_VIDEORENDERERCONTROL_H
+
+#include <QObject>
+
+class AalMediaPlayerService;
+class AalVideoRendererControl;
+class OffscreenVideoSurface;
+
+class tst_VideoRendererControl : public QObject
+{
+    Q_OBJECT
+
+    AalMediaPlayerService *m_service;
+    AalVideoRendererControl *m_renderer;
+    OffscreenVideoSurface *m_surface;
+
+private Q_SLOTS:
+    // We want the setup to be run prior to every test case to
+    // ensure correct test isolation, see http://qt-project.org/doc/qt-5/qtest-overview.html.
+    void init();
+    void cleanup();
+
+    void framesAreRecycled();
+    void benchmarkPresentFrame();
+    void mappedFramesForSoftwareSurface();
+    void noMappedSinkWithoutSupport();
+    void framePacing_data();
+    void framePacing();
+    void resolutionChangeKeepsSink();
+    void replayKeepsTexture();
+    void newMediaReleasesTexture();
+    void framesCarryTimestamps();
+    void texturesGoToWaitingRenderer();
+    void texturesFollowTheirFrame();
+    void interleavedHandshakesSwapTextures();
+    void noPresentWhileInvisible();
+    void backgroundReleasesTexture();
+
+private:
+    void startRendering();
+    void presentFrame();
+};
+
+#endif // TST_VIDEORENDERERCONTROL_H
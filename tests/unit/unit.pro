@@ -9,6 +9,7 @@ QT += multimedia opengl quick testlib
 PKGCONFIG += MediaHub
 
 INCLUDEPATH += ../../src/aal \
+    ../../src/modules/media \
     /usr/include/qt5/QtMultimedia \
     /usr/include/MediaHub \
     /usr/include/hybris \
@@ -21,23 +22,50 @@ HEADERS += \
     ../../src/aal/aalmediaplayerservice.h \
     ../../src/aal/aalmediaplayerserviceplugin.h \
     ../../src/aal/aalvideorenderercontrol.h \
+    ../../src/aal/aalvideoframepool.h \
+    ../../src/aal/aalsharedsignalrouter.h \
     ../../src/aal/aalmediaplaylistprovider.h \
     ../../src/aal/aalmediaplaylistcontrol.h \
     ../../src/aal/aalaudiorolecontrol.h \
+    ../../src/aal/aalbackendwatchdog.h \
+    ../../src/aal/aalflightrecorder.h \
+    ../../src/aal/aallogging.h \
+    ../../src/aal/aalplayercommandqueue.h \
+    ../../src/aal/aaltracer.h \
     ../../src/aal/aalutility.h \
+    ../../src/modules/media/playlistsnapshot.h \
+    ../../src/modules/media/qubuntumedia.h \
     tst_mediaplayerplugin.h \
     tst_mediaplaylistcontrol.h \
+    tst_qubuntumedia.h \
+    tst_videorenderercontrol.h \
+    offscreenvideosurface.h \
+    softwarevideosink.h \
     player.h
 
 SOURCES += \
     tst_mediaplayerplugin.cpp \
     tst_mediaplaylistcontrol.cpp \
+    tst_qubuntumedia.cpp \
+    tst_videorenderercontrol.cpp \
+    offscreenvideosurface.cpp \
+    softwarevideosink.cpp \
     player.cpp \
+    tracklist.cpp \
     ../../src/aal/aalmediaplayercontrol.cpp \
     ../../src/aal/aalmediaplaylistprovider.cpp \
     ../../src/aal/aalmediaplaylistcontrol.cpp \
     ../../src/aal/aalmediaplayerservice.cpp \
     ../../src/aal/aalmediaplayerserviceplugin.cpp \
     ../../src/aal/aalvideorenderercontrol.cpp \
+    ../../src/aal/aalvideoframepool.cpp \
+    ../../src/aal/aalsharedsignalrouter.cpp \
     ../../src/aal/aalaudiorolecontrol.cpp \
-    ../../src/aal/aalutility.cpp
+    ../../src/aal/aalbackendwatchdog.cpp \
+    ../../src/aal/aalflightrecorder.cpp \
+    ../../src/aal/aallogging.cpp \
+    ../../src/aal/aalplayercommandqueue.cpp \
+    ../../src/aal/aaltracer.cpp \
+    ../../src/aal/aalutility.cpp \
+    ../../src/modules/media/playlistsnapshot.cpp \
+    ../../src/modules/media/qubuntumedia.cpp
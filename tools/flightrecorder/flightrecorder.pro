@@ -0,0 +1,21 @@
+TARGET = aal-flight-recorder
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+QT = core
+QT += multimedia
+QMAKE_CXXFLAGS += -std=c++11
+
+INCLUDEPATH += ../../src/aal
+
+HEADERS += \
+    ../../src/aal/aalflightrecorder.h \
+    ../../src/aal/aallogging.h
+
+SOURCES += \
+    main.cpp \
+    ../../src/aal/aalflightrecorder.cpp \
+    ../../src/aal/aallogging.cpp
+
+target.path = /usr/bin
+INSTALLS += target
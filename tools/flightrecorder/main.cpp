@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2015 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Prints the events of a flight recorder dump, see AalFlightRecorder.
+//
+// Usage: aal-flight-recorder <dump>
+
+#include "aalflightrecorder.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QMediaPlayer>
+#include <QMetaEnum>
+#include <QTextStream>
+
+#include <cstring>
+
+namespace
+{
+QString enumKey(const char *enumName, qint64 value)
+{
+    const QMetaObject &mo = QMediaPlayer::staticMetaObject;
+    const QMetaEnum metaEnum = mo.enumerator(mo.indexOfEnumerator(enumName));
+    const char *key = metaEnum.valueToKey(int(value));
+    return key ? QString::fromLatin1(key) : QString::number(value);
+}
+
+QString playbackStatus(qint64 value)
+{
+    // lomiri::MediaHub::Player::PlaybackStatus
+    static const char *const names[] = { "Null", "Ready", "Playing", "Paused", "Stopped" };
+    if (value >= 0 && value < qint64(sizeof(names) / sizeof(names[0])))
+        return QString::fromLatin1(names[value]);
+    return QString::number(value);
+}
+
+QString describe(quint16 type, qint64 value, qint64 detail, const QStringList &names)
+{
+    switch (type) {
+    case AalFlightRecorder::StateChanged:
+        return QStringLiteral("state        %1").arg(enumKey("State", value));
+    case AalFlightRecorder::MediaStatusChanged:
+        return QStringLiteral("media status %1").arg(enumKey("MediaStatus", value));
+    case AalFlightRecorder::PlaybackStatusChanged:
+        return QStringLiteral("media-hub    %1").arg(playbackStatus(value));
+    case AalFlightRecorder::Seek:
+        return QStringLiteral("seek         %1 ms").arg(value / 1000.0, 0, 'f', 3);
+    case AalFlightRecorder::FramePresented:
+        if (value < 0)
+            return QStringLiteral("frame");
+        return QStringLiteral("frame        at %1 ms").arg(value / 1000.0, 0, 'f', 3);
+    case AalFlightRecorder::Buffering:
+        return QStringLiteral("buffering    %1%").arg(value);
+    case AalFlightRecorder::TrackChanged:
+        return QStringLiteral("track        %1").arg(value);
+    case AalFlightRecorder::Error:
+        return QStringLiteral("error        %1").arg(enumKey("Error", value));
+    case AalFlightRecorder::BackendCall:
+        return QStringLiteral("slow call    %1 took %2 ms")
+                .arg(detail >= 0 && detail < names.size() ? names.at(detail) : QStringLiteral("?"))
+                .arg(value / 1000.0, 0, 'f', 3);
+    default:
+        return QStringLiteral("unknown(%1)  %2 %3").arg(type).arg(value).arg(detail);
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    const QStringList args = app.arguments();
+    if (args.size() != 2) {
+        err << "Usage: " << args.value(0) << " <dump>" << endl;
+        return 1;
+    }
+
+    QFile file(args.at(1));
+    if (!file.open(QIODevice::ReadOnly)) {
+        err << "Can't open " << file.fileName() << ": " << file.errorString() << endl;
+        return 1;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    in.setByteOrder(QDataStream::LittleEndian);
+
+    char magic[sizeof(AalFlightRecorder::Magic)];
+    quint32 version = 0;
+    if (in.readRawData(magic, sizeof(magic)) != int(sizeof(magic))
+            || std::memcmp(magic, AalFlightRecorder::Magic, sizeof(magic)) != 0) {
+        err << file.fileName() << " is not a flight recorder dump" << endl;
+        return 1;
+    }
+    in >> version;
+    if (version != AalFlightRecorder::FormatVersion) {
+        err << "Unsupported dump format version " << version << endl;
+        return 1;
+    }
+
+    qint64 dumpWallMs = 0;
+    qint64 dumpSteadyNs = 0;
+    QStringList names;
+    quint32 count = 0;
+    in >> dumpWallMs >> dumpSteadyNs >> names >> count;
+
+    qint64 firstTimestamp = 0;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        quint64 sequence;
+        qint64 timestamp;
+        quint16 type;
+        qint64 value;
+        qint64 detail;
+        in >> sequence >> timestamp >> type >> value >> detail;
+        if (in.status() != QDataStream::Ok)
+            break;
+
+        if (i == 0)
+            firstTimestamp = timestamp;
+
+        const QDateTime wallTime = QDateTime::fromMSecsSinceEpoch(
+                    dumpWallMs - (dumpSteadyNs - timestamp) / 1000000);
+        out << qSetFieldWidth(8) << sequence << qSetFieldWidth(0) << "  "
+            << wallTime.toString(QStringLiteral("hh:mm:ss.zzz")) << "  +"
+            << qSetFieldWidth(10) << QString::number((timestamp - firstTimestamp) / 1e6, 'f', 3)
+            << qSetFieldWidth(0) << " ms  " << describe(type, value, detail, names) << endl;
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        err << "The dump is truncated" << endl;
+        return 1;
+    }
+
+    return 0;
+}